@@ -13,6 +13,7 @@ asm.cpp
 #include <bitset>
 // using map
 #include <map>
+#include "e20_image.h"
 
 using namespace std;
 
@@ -411,6 +412,7 @@ int main(int argc, char *argv[]) {
         Parse the command-line arguments
     */
     char *filename = nullptr;
+    char *image = nullptr;
     bool do_help = false;
     bool arg_error = false;
     for (int i=1; i<argc; i++) {
@@ -418,6 +420,12 @@ int main(int argc, char *argv[]) {
         if (arg.rfind("-",0)==0) {
             if (arg== "-h" || arg == "--help")
                 do_help = true;
+            else if (arg == "--e20bin") {
+                if (i + 1 < argc)
+                    image = argv[++i];
+                else
+                    arg_error = true;
+            }
             else
                 arg_error = true;
         } else {
@@ -428,20 +436,25 @@ int main(int argc, char *argv[]) {
         }
     }
     // Display error message if appropriate
-//    if (arg_error || do_help || filename == nullptr) {
-//        cerr << "usage " << argv[0] << " [-h] filename" << endl << endl;
-//        cerr << "Assemble E20 files into machine code" << endl << endl;
-//        cerr << "positional arguments:" << endl;
-//        cerr << "  filename    The file containing assembly language, typically with .s suffix" << endl<<endl;
-//        cerr << "optional arguments:"<<endl;
-//        cerr << "  -h, --help  show this help message and exit"<<endl;
-//        return 1;
-//    }
+    if (arg_error || do_help) {
+        cerr << "usage " << argv[0] << " [-h] [--e20bin FILE] [filename]" << endl << endl;
+        cerr << "Assemble E20 files into machine code" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing assembly language, typically with .s suffix" << endl;
+        cerr << "              (default hw7q1.txt)" << endl<<endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --e20bin FILE  Write a binary .e20bin image, with the labels as symbols, to FILE"<<endl;
+        cerr << "              instead of printing machine code"<<endl;
+        return 1;
+    }
+    if (filename == nullptr)
+        filename = (char *)"hw7q1.txt";
     
     /* go through file to look for all labels
         add them & their corresponding val to a vector */
     // open file
-    ifstream f_label("hw7q1.txt");
+    ifstream f_label(filename);
     // check if that was valid
     if (!f_label.is_open()) {
         cerr << "Can't open file "<<filename<<endl;
@@ -471,7 +484,7 @@ int main(int argc, char *argv[]) {
     /* iterate through the line in the file, construct a list
        of numeric values representing machine code */
     // reopen file to process it again
-    ifstream f("hw7q1.txt");
+    ifstream f(filename);
     // check if that was valid
     if (!f.is_open()) {
         cerr << "Can't open file "<<filename<<endl;
@@ -508,6 +521,22 @@ int main(int argc, char *argv[]) {
 
 
 
+    if (image != nullptr) {
+        vector<uint16_t> words(instructions.begin(), instructions.end());
+        vector<ImageSymbol> symbols;
+        for (const auto &label : labels) {
+            // labels are kept with their colon
+            ImageSymbol sym = {(uint16_t)label.second, label.first.substr(0, label.first.size() - 1)};
+            symbols.push_back(sym);
+        }
+        string error;
+        if (!write_image(image, words, 0, symbols, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     /* print out each instruction in the required format */
     unsigned address = 0;
     for (unsigned instruction : instructions) {
@@ -0,0 +1,742 @@
+/*
+E20 simulator core
+e20.h
+
+Machine state, decoder and interpreter shared by sim.cpp and
+simcache.cpp. Everything is defined inline, so a front end (or any
+other program that wants to embed the simulator) just includes this
+header and is compiled as usual.
+*/
+
+#ifndef E20_H
+#define E20_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+// Some helpful constant values that we'll be using.
+size_t const static NUM_REGS = 8;
+size_t const static MEM_SIZE = 1<<13;
+// pass as the instruction limit to run until the program halts
+uint64_t const static RUN_UNTIL_HALT = UINT64_MAX;
+
+/*
+    sign_extend(imm, msb)
+    checks if the msb of imm is 0 or 1
+        if its 1, it sign extends imm so its 16 bits
+    parameters:
+        imm = immediate value
+        msb = number indicating which bit is the most significant bit of imm
+ */
+inline uint16_t sign_extend(uint16_t imm, int msb) {
+    uint16_t check = 1 << (msb - 1);
+    if ((imm & check) == check) {
+        // sign extend by 1
+        if (msb == 7) {
+            // 65408 = 1111111110000000
+            imm = (imm | 65408);
+        }
+        else { // msb == 13
+            // 57344 = 1110000000000000
+            imm = imm | 57344;
+        }
+    }
+    return imm;
+}
+
+// operation kinds of a predecoded instruction
+    // any instruction whose only effect would be a write to $0 decodes to OP_NOP
+enum Op : uint8_t {
+    OP_ADD, OP_SUB, OP_OR, OP_AND, OP_SLT, OP_JR,
+    OP_SLTI, OP_LW, OP_SW, OP_JEQ, OP_ADDI,
+    OP_J, OP_JAL, OP_NOP
+};
+
+/*
+    DecodedInstr
+    compact record holding an instruction after it has been decoded once
+        op = operation kind (one of Op)
+        a = first register field (srcA for 3 register ops, regSrc for 2 register ops),
+            unused by j except for the LOOP_UNSUITABLE mark
+        b = second register field (srcB for 3 register ops, regDst for 2 register ops)
+        dst = register written by the instruction
+        imm = immediate, already sign extended to 16 bits for addi/slti/lw/sw/jeq
+            and the 13 bit absolute address for j/jal
+ */
+struct DecodedInstr {
+    uint8_t op;
+    uint8_t a;
+    uint8_t b;
+    uint8_t dst;
+    uint16_t imm;
+};
+
+/*
+    decode(instr)
+    splits a machine code instruction into its fields
+        returns the decoded record for instr
+    parameters:
+        instr = 16 bit machine code instruction
+ */
+inline DecodedInstr decode(uint16_t instr) {
+    DecodedInstr d = {OP_NOP, 0, 0, 0, 0};
+    // & instr with 11100000000000000 to get 3 msb
+    int three_msb = (instr & 57344) >> 13;
+    // 7168 = 0001110000000000
+    int regA = (instr & 7168) >> 10;
+    // 896 = 0000001110000000
+    int regB = (instr & 896) >> 7;
+    // 3 register arguments
+    if (three_msb == 0) {
+        // 15 = 0000000000001111
+        int four_lsb = instr & 15;
+        // 112 = 0000000001110000
+        int dst = (instr & 112) >> 4;
+        d.a = regA;
+        d.b = regB;
+        d.dst = dst;
+        // jr doesn't modify regDst
+            // thus, it doesn't matter if regDst == 0
+        if (four_lsb == 8) {
+            d.op = OP_JR;
+        }
+        // register 0 is immutable
+        else if ((dst != 0) & (four_lsb <= 4)) {
+            // add, sub, or, and, slt are numbered in func order
+            d.op = OP_ADD + four_lsb;
+        }
+    }
+    // no register arguments
+    else if ((three_msb == 2) | (three_msb == 3)) {
+        // 8191 = 0001111111111111
+        // imm = non-negative absolute address
+        d.imm = instr & 8191;
+        if (three_msb == 2) {
+            d.op = OP_J;
+        }
+        else {
+            d.op = OP_JAL;
+        }
+    }
+    // two register arguments
+    else {
+        d.a = regA;
+        d.b = regB;
+        d.dst = regB;
+        // 127 = 0000000001111111
+        d.imm = sign_extend(instr & 127, 7);
+        // sw & jeq don't modify regDst
+            // thus, it doesn't matter if regDst == 0
+        if (three_msb == 5) {
+            d.op = OP_SW;
+        }
+        else if (three_msb == 6) {
+            d.op = OP_JEQ;
+        }
+        // slti, lw, addi
+        else if (regB != 0) {
+            if (three_msb == 7) {
+                d.op = OP_SLTI;
+            }
+            else if (three_msb == 4) {
+                d.op = OP_LW;
+            }
+            else { // three_msb == 1
+                d.op = OP_ADDI;
+            }
+        }
+    }
+    return d;
+}
+
+/*
+    predecode(mem, decoded)
+    decodes every memory cell once, filling in the predecoded image
+    parameters:
+        mem[] = array containing the memory cells 0-8191
+        decoded[] = array receiving one decoded record per memory cell
+ */
+inline void predecode(const uint16_t mem[], DecodedInstr decoded[]) {
+    for (size_t addr = 0; addr < MEM_SIZE; addr++) {
+        decoded[addr] = decode(mem[addr]);
+    }
+}
+
+/*
+    Machine
+    complete state of one E20 machine
+        pc = program counter
+        regs = values of regs 0-7 ($0 is never written)
+        mem = memory cells 0-8191
+        decoded = predecoded image of mem, kept in sync by every store
+        halted = set once the machine has executed a halt (j to itself)
+ */
+struct Machine {
+    uint16_t pc;
+    uint16_t regs[NUM_REGS];
+    uint16_t mem[MEM_SIZE];
+    DecodedInstr decoded[MEM_SIZE];
+    bool halted;
+};
+
+/*
+    init_machine(m)
+    puts m into the power-on state: pc, regs and mem all 0
+    parameters:
+        m = machine being reset
+ */
+inline void init_machine(Machine &m) {
+    m.pc = 0;
+    memset(m.regs, 0, sizeof(m.regs));
+    memset(m.mem, 0, sizeof(m.mem));
+    predecode(m.mem, m.decoded);
+    m.halted = false;
+}
+
+/*
+    scan_machine_code_line(p, eol, addr, instr)
+    picks apart one line of machine code, ram[ADDR] = 16'bBITS; followed by anything
+    returns false if the line isn't in that form
+    parameters:
+        p, eol = the line, without its line break
+        addr = receives ADDR
+        instr = receives BITS, kept to its low 16 bits
+ */
+inline bool scan_machine_code_line(const char *p, const char *eol, size_t &addr, uint16_t &instr) {
+    if (eol - p < 4 || memcmp(p, "ram[", 4) != 0) {
+        return false;
+    }
+    p += 4;
+    const char *digits = p;
+    addr = 0;
+    while (p < eol && *p >= '0' && *p <= '9') {
+        // saturate far past MEM_SIZE; any such address is an error anyway
+        if (addr < 100000000) {
+            addr = addr * 10 + (*p - '0');
+        }
+        p++;
+    }
+    if (p == digits || eol - p < 9 || memcmp(p, "] = 16'b", 8) != 0) {
+        return false;
+    }
+    p += 8;
+    digits = p;
+    instr = 0;
+    while (p < eol && (*p == '0' || *p == '1')) {
+        instr = (instr << 1) | (*p - '0');
+        p++;
+    }
+    return p != digits && p < eol && *p == ';';
+}
+
+/*
+    parse_machine_code_bytes(data, size, m, error)
+    reads E20 machine code held in memory (a mapped or slurped file) into the memory of m
+        in one pass, and decodes every memory cell into m.decoded once it's all been read
+    returns false, with a description in error, if the machine code is malformed
+    parameters:
+        data, size = contents of the machine code file
+        m = machine into whose memory the program is read
+        error = receives the error message
+ */
+inline bool parse_machine_code_bytes(const char *data, size_t size, Machine &m, std::string &error) {
+    const char *p = data;
+    const char *end = data + size;
+    size_t expectedaddr = 0;
+    while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        const char *next = eol != nullptr ? eol + 1 : end;
+        if (eol == nullptr) {
+            eol = end;
+        }
+        // tolerate files with DOS line breaks
+        if (eol > p && eol[-1] == '\r') {
+            eol--;
+        }
+        size_t addr;
+        uint16_t instr;
+        if (!scan_machine_code_line(p, eol, addr, instr)) {
+            error = "Can't parse line: " + std::string(p, eol);
+            return false;
+        }
+        if (addr != expectedaddr) {
+            error = "Memory addresses encountered out of sequence: " + std::to_string(addr);
+            return false;
+        }
+        if (addr >= MEM_SIZE) {
+            error = "Program too big for memory";
+            return false;
+        }
+        expectedaddr ++;
+        m.mem[addr] = instr;
+        p = next;
+    }
+    predecode(m.mem, m.decoded);
+    return true;
+}
+
+/*
+    parse_machine_code(f, m, error)
+    reads an E20 machine code file into the memory of m
+        and decodes every memory cell into m.decoded once the whole file has been read
+    returns false, with a description in error, if the file is malformed
+    parameters:
+        f = open file to read from
+        m = machine into whose memory the program is read
+        error = receives the error message
+ */
+inline bool parse_machine_code(std::istream &f, Machine &m, std::string &error) {
+    std::string contents;
+    char block[1 << 16];
+    while (f.read(block, sizeof(block)) || f.gcount() > 0) {
+        contents.append(block, f.gcount());
+    }
+    return parse_machine_code_bytes(contents.data(), contents.size(), m, error);
+}
+
+/*
+    Loads an E20 machine code file into the memory
+    of m. We assume that memory is large enough to
+    hold the values in the machine code file.
+
+    Once the whole file has been read, every memory cell
+    is decoded into m.decoded, so the interpreter never has
+    to pick apart the instruction bits itself.
+
+    @param f Open file to read from
+    @param m Machine into whose memory the program is read
+*/
+inline void load_machine_code(std::istream &f, Machine &m) {
+    std::string error;
+    if (!parse_machine_code(f, m, error)) {
+        std::cerr << error << std::endl;
+        exit(1);
+    }
+}
+
+/*
+    Prints the current state of the simulator, including
+    the current program counter, the current register values,
+    and the first memquantity elements of memory.
+
+    @param out Stream to print to
+    @param pc The final value of the program counter
+    @param regs Final value of all registers
+    @param memory Final value of memory
+    @param memquantity How many words of memory to dump
+*/
+inline void print_state(std::ostream &out, uint16_t pc, const uint16_t regs[], const uint16_t memory[], size_t memquantity) {
+    out << std::setfill(' ') << std::dec;
+    out << "Final state:" << std::endl;
+    out << "\tpc=" << std::setw(5) << pc << std::endl;
+
+    for (size_t reg=0; reg<NUM_REGS; reg++)
+        out << "\t$" << reg << "=" << std::setw(5) << regs[reg] << std::endl;
+
+    out << std::setfill('0');
+    bool cr = false;
+    for (size_t count=0; count<memquantity; count++) {
+        out << std::hex << std::setw(4) << memory[count] << " ";
+        cr = true;
+        if (count % 8 == 7) {
+            out << std::endl;
+            cr = false;
+        }
+    }
+    if (cr)
+        out << std::endl;
+}
+
+/*
+    print_state(pc, regs, memory, memquantity)
+    same as print_state(out, ...), printing to std::cout
+ */
+inline void print_state(uint16_t pc, const uint16_t regs[], const uint16_t memory[], size_t memquantity) {
+    print_state(std::cout, pc, regs, memory, memquantity);
+}
+
+/*
+    NoObserver
+    observer that ignores everything
+        step and run call obs.on_instr(pc, instr) before every instruction, with its machine code,
+        obs.on_lw(pc, addr, value) after every lw that writes a register, with the word loaded,
+        obs.on_sw(pc, addr, value) after every sw, with the word stored
+            (addr is already wrapped to 13 bits in both),
+        and obs.on_jeq(pc, taken) after every jeq
+        any type with those members can be passed in its place; deriving from NoObserver
+            supplies the ones it doesn't care about, and the calls to those compile away
+        sees_every_instruction = false lets run skip counted loops (see fast_forward_loop)
+            without calling on_instr for the skipped instructions; observers that count
+            instructions set it to true
+ */
+struct NoObserver {
+    static const bool sees_every_instruction = false;
+    void on_instr(uint16_t, uint16_t) {}
+    void on_lw(uint16_t, int, uint16_t) {}
+    void on_sw(uint16_t, int, uint16_t) {}
+    void on_jeq(uint16_t, bool) {}
+};
+
+/*
+    step(m, obs)
+    executes the single instruction at m.pc and advances m.pc
+        a store re-decodes the cell it wrote, so self-modifying programs still see their new instructions
+        never allocates
+    returns true if the instruction was a halt
+    parameters:
+        m = machine being stepped
+        obs = observer told about every instruction, lw, sw and jeq (see NoObserver)
+ */
+template <typename Observer>
+inline bool step(Machine &m, Observer &obs) {
+    uint16_t pc = m.pc;
+    uint16_t *regs = m.regs;
+    // when accessing memory, only use the 13 lsb of the pc
+    // 8191 = 1111111111111
+    const DecodedInstr &d = m.decoded[pc & 8191];
+    obs.on_instr(pc, m.mem[pc & 8191]);
+    // increment program counter
+        // if instruction caused jump, will update new_pc later
+    uint16_t new_pc = pc + 1;
+    switch (d.op) {
+        case OP_ADD:
+            regs[d.dst] = regs[d.a] + regs[d.b];
+            break;
+        case OP_SUB:
+            regs[d.dst] = regs[d.a] - regs[d.b];
+            break;
+        case OP_OR:
+            regs[d.dst] = regs[d.a] | regs[d.b];
+            break;
+        case OP_AND:
+            regs[d.dst] = regs[d.a] & regs[d.b];
+            break;
+        case OP_SLT:
+            regs[d.dst] = regs[d.a] < regs[d.b];
+            break;
+        case OP_JR:
+            new_pc = regs[d.a];
+            break;
+        case OP_SLTI:
+            // only op where imm = unsigned
+            regs[d.dst] = regs[d.a] < d.imm;
+            break;
+        case OP_LW: {
+            // only least significant 13 bits of mem_addr are used to index into memory
+            int mem_addr = (regs[d.a] + d.imm) & 8191;
+            regs[d.dst] = m.mem[mem_addr];
+            obs.on_lw(pc, mem_addr, m.mem[mem_addr]);
+            break;
+        }
+        case OP_SW: {
+            int mem_addr = (regs[d.a] + d.imm) & 8191;
+            m.mem[mem_addr] = regs[d.b];
+            // the stored word may be executed later
+            m.decoded[mem_addr] = decode(m.mem[mem_addr]);
+            obs.on_sw(pc, mem_addr, m.mem[mem_addr]);
+            break;
+        }
+        case OP_JEQ:
+            if (regs[d.a] == regs[d.b]) {
+                new_pc = pc + d.imm + 1;
+            }
+            obs.on_jeq(pc, regs[d.a] == regs[d.b]);
+            break;
+        case OP_ADDI:
+            regs[d.dst] = regs[d.a] + d.imm;
+            break;
+        case OP_J:
+            new_pc = d.imm;
+            // check for halt
+            if (new_pc == pc) {
+                m.halted = true;
+            }
+            break;
+        case OP_JAL:
+            regs[7] = pc + 1;
+            new_pc = d.imm;
+            break;
+        default: // OP_NOP
+            break;
+    }
+    m.pc = new_pc;
+    return m.halted;
+}
+
+/*
+    step(m)
+    same as step(m, obs) for callers that don't watch memory accesses
+ */
+inline bool step(Machine &m) {
+    NoObserver obs;
+    return step(m, obs);
+}
+
+// loop fast-forwarding can be compiled out to time the interpreter on its own
+#if !defined(E20_NO_LOOP_FASTFORWARD)
+#define E20_LOOP_FASTFORWARD 1
+#else
+#define E20_LOOP_FASTFORWARD 0
+#endif
+
+// longest loop body (the closing j included) fast_forward_loop looks at
+size_t const static MAX_LOOP_LEN = 32;
+// put in DecodedInstr::a of a backward j once its loop is known not to fit fast_forward_loop
+    // re-decoding the j (a store to it) clears the mark
+uint8_t const static LOOP_UNSUITABLE = 1;
+
+/*
+    fast_forward_loop(regs, decoded, jump_pc, pc, budget)
+    called right after the backward j at jump_pc has jumped to the top of its loop
+        if the loop is a counted loop, skips straight to the state stepping it would reach
+        a counted loop is made only of addi $r,$r,imm (at most one per register),
+            nops, and exactly one jeq leaving the loop
+        the number of iterations is solved for from (a0 - b0) + (da - db) * i == 0 (mod 2^16)
+        if the loop doesn't end within budget instructions, only whole iterations are skipped
+    returns the number of instructions skipped, 0 if none
+    parameters:
+        regs = registers, updated to their values after the skipped instructions
+        decoded = predecoded image; the j is marked with LOOP_UNSUITABLE if its loop doesn't fit
+        jump_pc = address of the j
+        pc = pc after the j (top of the loop); updated to the pc to continue at
+        budget = most instructions that may be skipped
+ */
+inline uint64_t fast_forward_loop(uint16_t regs[], DecodedInstr decoded[], uint16_t jump_pc, uint16_t &pc,
+        uint64_t budget) {
+    uint16_t top = pc;
+    if (jump_pc >= MEM_SIZE || top >= jump_pc || (size_t)(jump_pc - top) >= MAX_LOOP_LEN) {
+        decoded[jump_pc & 8191].a = LOOP_UNSUITABLE;
+        return 0;
+    }
+    uint16_t step[NUM_REGS] = {0};
+    bool before_exit[NUM_REGS] = {false};
+    bool induction[NUM_REGS] = {false};
+    int exit_at = -1;
+    for (uint16_t addr = top; addr < jump_pc; addr++) {
+        const DecodedInstr &d = decoded[addr];
+        if (d.op == OP_ADDI && d.a == d.dst && !induction[d.dst]) {
+            induction[d.dst] = true;
+            step[d.dst] = d.imm;
+            before_exit[d.dst] = exit_at < 0;
+        }
+        else if (d.op == OP_JEQ && exit_at < 0) {
+            uint16_t target = addr + d.imm + 1;
+            if (target >= top && target <= jump_pc) {
+                exit_at = -2;
+                break;
+            }
+            exit_at = addr - top;
+        }
+        else if (d.op != OP_NOP) {
+            exit_at = -2;
+            break;
+        }
+    }
+    if (exit_at < 0) {
+        decoded[jump_pc & 8191].a = LOOP_UNSUITABLE;
+        return 0;
+    }
+    const DecodedInstr &cmp = decoded[top + exit_at];
+    // in iteration i the jeq compares r0 + step * (i + before_exit) for both registers
+    uint16_t diff = step[cmp.a] - step[cmp.b];
+    uint16_t want = (regs[cmp.b] + (before_exit[cmp.b] ? step[cmp.b] : 0)) -
+        (regs[cmp.a] + (before_exit[cmp.a] ? step[cmp.a] : 0));
+    // solve diff * i == want (mod 2^16) for the first i
+    uint32_t iterations;
+    if (diff == 0) {
+        iterations = 0;
+        if (want != 0) {
+            // never leaves
+            decoded[jump_pc & 8191].a = LOOP_UNSUITABLE;
+            return 0;
+        }
+    }
+    else {
+        uint16_t g = diff & -diff;
+        if (want % g != 0) {
+            decoded[jump_pc & 8191].a = LOOP_UNSUITABLE;
+            return 0;
+        }
+        uint16_t odd = diff / g;
+        // inverse of odd mod 2^16 by Newton's method; each round doubles the correct low bits
+        uint32_t inv = odd;
+        for (int round = 0; round < 4; round++) {
+            inv *= 2 - odd * inv;
+        }
+        uint32_t modulus = 65536 / g;
+        iterations = (uint32_t)(want / g) * inv % modulus;
+    }
+    uint64_t length = jump_pc - top + 1;
+    uint64_t total = iterations * length + exit_at + 1;
+    if (total <= budget) {
+        for (size_t r = 1; r < NUM_REGS; r++) {
+            regs[r] += step[r] * (iterations + before_exit[r]);
+        }
+        pc = top + exit_at + cmp.imm + 1;
+        return total;
+    }
+    uint64_t whole = budget / length;
+    for (size_t r = 1; r < NUM_REGS; r++) {
+        regs[r] += step[r] * whole;
+    }
+    return whole * length;
+}
+
+// computed goto is a GCC/Clang extension; other compilers get the switch loop
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(E20_NO_COMPUTED_GOTO)
+#define E20_COMPUTED_GOTO 1
+#else
+#define E20_COMPUTED_GOTO 0
+#endif
+
+/*
+    run(m, n, obs)
+    executes up to n instructions, stopping early if the program halts
+        uses direct-threaded dispatch: every handler jumps straight to the handler
+            of the next instruction through a table of label addresses,
+            instead of returning to a shared loop
+        falls back to a switch inside a loop when computed goto isn't available
+        counted loops are skipped over in one go (see fast_forward_loop)
+        leaves m in exactly the state the same number of step calls would
+        never allocates
+    returns the number of instructions executed (the halt included)
+    parameters:
+        m = machine being run
+        n = instruction limit, RUN_UNTIL_HALT for none
+        obs = observer told about every instruction, lw, sw and jeq (see NoObserver)
+ */
+template <typename Observer>
+inline uint64_t run(Machine &m, uint64_t n, Observer &obs) {
+    if (m.halted) {
+        return 0;
+    }
+    uint16_t pc = m.pc;
+    uint16_t *regs = m.regs;
+    uint16_t *mem = m.mem;
+    DecodedInstr *decoded = m.decoded;
+    uint64_t count = 0;
+    const DecodedInstr *d;
+#if E20_COMPUTED_GOTO
+    // must list the handlers in the same order as Op
+    static void* const handlers[] = {
+        &&do_OP_ADD, &&do_OP_SUB, &&do_OP_OR, &&do_OP_AND, &&do_OP_SLT, &&do_OP_JR,
+        &&do_OP_SLTI, &&do_OP_LW, &&do_OP_SW, &&do_OP_JEQ, &&do_OP_ADDI,
+        &&do_OP_J, &&do_OP_JAL, &&do_OP_NOP
+    };
+#define HANDLER(op) do_##op:
+#define DISPATCH() do { if (count == n) goto done; count++; d = &decoded[pc & 8191]; obs.on_instr(pc, mem[pc & 8191]); goto *handlers[d->op]; } while (0)
+    DISPATCH();
+    {
+#else
+#define HANDLER(op) case op:
+#define DISPATCH() goto dispatch
+dispatch:
+    if (count == n) goto done;
+    count++;
+    d = &decoded[pc & 8191];
+    obs.on_instr(pc, mem[pc & 8191]);
+    switch (d->op) {
+#endif
+    HANDLER(OP_ADD)
+        regs[d->dst] = regs[d->a] + regs[d->b];
+        pc++;
+        DISPATCH();
+    HANDLER(OP_SUB)
+        regs[d->dst] = regs[d->a] - regs[d->b];
+        pc++;
+        DISPATCH();
+    HANDLER(OP_OR)
+        regs[d->dst] = regs[d->a] | regs[d->b];
+        pc++;
+        DISPATCH();
+    HANDLER(OP_AND)
+        regs[d->dst] = regs[d->a] & regs[d->b];
+        pc++;
+        DISPATCH();
+    HANDLER(OP_SLT)
+        regs[d->dst] = regs[d->a] < regs[d->b];
+        pc++;
+        DISPATCH();
+    HANDLER(OP_JR)
+        pc = regs[d->a];
+        DISPATCH();
+    HANDLER(OP_SLTI)
+        regs[d->dst] = regs[d->a] < d->imm;
+        pc++;
+        DISPATCH();
+    HANDLER(OP_LW) {
+        int mem_addr = (regs[d->a] + d->imm) & 8191;
+        regs[d->dst] = mem[mem_addr];
+        obs.on_lw(pc, mem_addr, mem[mem_addr]);
+        pc++;
+        DISPATCH();
+    }
+    HANDLER(OP_SW) {
+        int mem_addr = (regs[d->a] + d->imm) & 8191;
+        mem[mem_addr] = regs[d->b];
+        decoded[mem_addr] = decode(mem[mem_addr]);
+        obs.on_sw(pc, mem_addr, mem[mem_addr]);
+        pc++;
+        DISPATCH();
+    }
+    HANDLER(OP_JEQ)
+        if (regs[d->a] == regs[d->b]) {
+            obs.on_jeq(pc, true);
+            pc = pc + d->imm + 1;
+        }
+        else {
+            obs.on_jeq(pc, false);
+            pc++;
+        }
+        DISPATCH();
+    HANDLER(OP_ADDI)
+        regs[d->dst] = regs[d->a] + d->imm;
+        pc++;
+        DISPATCH();
+    HANDLER(OP_J)
+        // j to itself is a halt
+        if (d->imm == pc) {
+            m.halted = true;
+            goto done;
+        }
+#if E20_LOOP_FASTFORWARD
+        if (!Observer::sees_every_instruction && d->imm < pc && d->a != LOOP_UNSUITABLE) {
+            // a copy, so pc itself never has its address taken and stays in a register
+            uint16_t next_pc = d->imm;
+            count += fast_forward_loop(regs, decoded, pc, next_pc, n - count);
+            pc = next_pc;
+            DISPATCH();
+        }
+#endif
+        pc = d->imm;
+        DISPATCH();
+    HANDLER(OP_JAL)
+        regs[7] = pc + 1;
+        pc = d->imm;
+        DISPATCH();
+    HANDLER(OP_NOP)
+        pc++;
+        DISPATCH();
+    }
+#undef HANDLER
+#undef DISPATCH
+done:
+    m.pc = pc;
+    return count;
+}
+
+/*
+    run(m, n)
+    same as run(m, n, obs) for callers that don't watch memory accesses
+ */
+inline uint64_t run(Machine &m, uint64_t n) {
+    NoObserver obs;
+    return run(m, n, obs);
+}
+
+#endif // E20_H
@@ -0,0 +1,485 @@
+/*
+E20 simulator block translation engine
+e20_block.h
+
+Runs a Machine one basic block at a time. A basic block is a straight
+line of instructions ending in j, jal, jr, jeq or halt. Each block is
+translated once into an array of micro-ops, each pointing at a handler
+specialized for its operation (and, for a few common shapes, for its
+operands), and is kept in a translation cache keyed by start address.
+Blocks remember the block they exited to, so a loop runs from block to
+block without going back through the cache.
+*/
+
+#ifndef E20_BLOCK_H
+#define E20_BLOCK_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "e20.h"
+
+// longest run of instructions translated into one block
+size_t const static MAX_BLOCK_LEN = 64;
+// once this many blocks have been thrown away by stores, the whole cache is flushed
+size_t const static MAX_INVALID_BLOCKS = 4096;
+
+struct BlockEngine;
+struct MicroOp;
+
+// every handler runs one micro-op and then the rest of the block, returning nullptr once the block is left
+typedef const MicroOp *(*MicroOpFn)(BlockEngine &e, const MicroOp *u);
+
+/*
+    MicroOp
+    one translated instruction
+        fn = handler executing it
+        pc = address of the instruction
+        count = number of instructions executed once this one is done (its position in the block + 1)
+        a, b, dst, imm = same as in DecodedInstr
+ */
+struct MicroOp {
+    MicroOpFn fn;
+    uint16_t pc;
+    uint16_t count;
+    uint16_t imm;
+    uint8_t a;
+    uint8_t b;
+    uint8_t dst;
+};
+
+/*
+    Block
+    one translated basic block
+        start, end = first and last address covered (inclusive)
+        length = number of instructions in the block
+        valid = cleared when a store overwrites part of the block
+        link[] = block last reached through the jump/taken exit (0) and the fall-through exit (1)
+        uops = the translated instructions, followed by a fall-through exit when the block
+            doesn't end in a jump
+ */
+struct Block {
+    uint16_t start;
+    uint16_t end;
+    uint32_t length;
+    bool valid;
+    Block *link[2];
+    std::vector<MicroOp> uops;
+};
+
+/*
+    BlockEngine
+    translation cache and exit state for running one Machine block by block
+        m = machine being run
+        regs, mem = m.regs and m.mem, kept here to save handlers a load
+        cache[] = valid block starting at each address, or nullptr
+        cover[] = number of valid blocks containing each address
+        blocks = owns every block translated since the last flush
+        invalid_blocks = number of blocks in blocks that are no longer valid
+        current = block being executed
+        next_pc, exit_slot, executed = filled in by the micro-op that leaves current:
+            the pc to continue at, which link[] to follow (-1 for none)
+            and how many instructions of current were executed
+ */
+struct BlockEngine {
+    Machine &m;
+    uint16_t *regs;
+    uint16_t *mem;
+    Block *cache[MEM_SIZE];
+    uint16_t cover[MEM_SIZE];
+    std::vector<std::unique_ptr<Block>> blocks;
+    size_t invalid_blocks;
+    Block *current;
+    uint16_t next_pc;
+    int exit_slot;
+    uint32_t executed;
+
+    explicit BlockEngine(Machine &machine) : m(machine), regs(machine.regs), mem(machine.mem), invalid_blocks(0), current(nullptr),
+            next_pc(0), exit_slot(-1), executed(0) {
+        for (size_t i = 0; i < MEM_SIZE; i++) {
+            cache[i] = nullptr;
+            cover[i] = 0;
+        }
+    }
+};
+
+/*
+    flush_blocks(e)
+    throws away every translated block
+    parameters:
+        e = engine whose translation cache is emptied
+ */
+inline void flush_blocks(BlockEngine &e) {
+    for (size_t i = 0; i < MEM_SIZE; i++) {
+        e.cache[i] = nullptr;
+        e.cover[i] = 0;
+    }
+    e.blocks.clear();
+    e.invalid_blocks = 0;
+    e.current = nullptr;
+}
+
+/*
+    invalidate_code(e, addr)
+    drops every valid block that contains addr, after addr has been overwritten
+        a block is never longer than MAX_BLOCK_LEN, so only blocks starting
+            in the MAX_BLOCK_LEN addresses up to addr need to be checked
+    parameters:
+        e = engine owning the blocks
+        addr = memory address that was written
+ */
+inline void invalidate_code(BlockEngine &e, int addr) {
+    int first = addr - (int)MAX_BLOCK_LEN + 1;
+    if (first < 0) {
+        first = 0;
+    }
+    for (int start = first; start <= addr; start++) {
+        Block *b = e.cache[start];
+        if (b != nullptr && b->end >= addr) {
+            b->valid = false;
+            e.cache[start] = nullptr;
+            for (int i = b->start; i <= b->end; i++) {
+                e.cover[i]--;
+            }
+            e.invalid_blocks++;
+        }
+    }
+}
+
+/*
+    leave_block(e, u, next_pc, exit_slot)
+    records where execution continues after the micro-op u ends the block
+        returns nullptr, so handlers can return its result directly
+    parameters:
+        e = engine running the block
+        u = last micro-op executed
+        next_pc = pc to continue at
+        exit_slot = link[] to follow, -1 if the successor can't be linked
+ */
+inline const MicroOp *leave_block(BlockEngine &e, const MicroOp *u, uint16_t next_pc, int exit_slot) {
+    e.next_pc = next_pc;
+    e.exit_slot = exit_slot;
+    e.executed = u->count;
+    return nullptr;
+}
+
+/*
+    next_uop(e, u)
+    runs the micro-op after u
+        handlers tail-call this, so a block runs as a chain of jumps from handler to handler
+        the chain ends at the block's last micro-op, so it never nests deeper than one block
+    parameters:
+        e = engine running the block
+        u = micro-op that just finished
+ */
+inline const MicroOp *next_uop(BlockEngine &e, const MicroOp *u) {
+    return u[1].fn(e, u + 1);
+}
+
+inline const MicroOp *uop_add(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] + e.regs[u->b];
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_sub(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] - e.regs[u->b];
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_or(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] | e.regs[u->b];
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_and(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] & e.regs[u->b];
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_slt(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] < e.regs[u->b];
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_slti(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] < u->imm;
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_addi(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.regs[u->a] + u->imm;
+    return next_uop(e, u);
+}
+
+// addi from $0 (movi): the result is the immediate itself
+inline const MicroOp *uop_movi(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = u->imm;
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_lw(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.mem[(e.regs[u->a] + u->imm) & 8191];
+    return next_uop(e, u);
+}
+
+// lw off $0: the address is known at translation time and kept in imm
+inline const MicroOp *uop_lw_abs(BlockEngine &e, const MicroOp *u) {
+    e.regs[u->dst] = e.mem[u->imm];
+    return next_uop(e, u);
+}
+
+/*
+    store_word(e, u, mem_addr)
+    shared tail of the sw handlers
+        keeps the predecoded image in sync and drops any block the store overwrote
+        leaves the block straight after the store if that block was the current one
+    parameters:
+        e = engine running the block
+        u = micro-op of the sw
+        mem_addr = wrapped address being stored to
+ */
+inline const MicroOp *store_word(BlockEngine &e, const MicroOp *u, int mem_addr) {
+    uint16_t value = e.regs[u->b];
+    if (e.mem[mem_addr] == value) {
+        return next_uop(e, u);
+    }
+    e.mem[mem_addr] = value;
+    e.m.decoded[mem_addr] = decode(value);
+    if (e.cover[mem_addr] != 0) {
+        invalidate_code(e, mem_addr);
+        if (!e.current->valid) {
+            return leave_block(e, u, u->pc + 1, -1);
+        }
+    }
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_sw(BlockEngine &e, const MicroOp *u) {
+    return store_word(e, u, (e.regs[u->a] + u->imm) & 8191);
+}
+
+// sw off $0: the address is known at translation time and kept in imm
+inline const MicroOp *uop_sw_abs(BlockEngine &e, const MicroOp *u) {
+    return store_word(e, u, u->imm);
+}
+
+inline const MicroOp *uop_nop(BlockEngine &e, const MicroOp *u) {
+    return next_uop(e, u);
+}
+
+inline const MicroOp *uop_jeq(BlockEngine &e, const MicroOp *u) {
+    if (e.regs[u->a] == e.regs[u->b]) {
+        return leave_block(e, u, u->pc + u->imm + 1, 0);
+    }
+    return leave_block(e, u, u->pc + 1, 1);
+}
+
+// jeq against $0: compare with zero instead of reading regs[0]
+inline const MicroOp *uop_jeqz(BlockEngine &e, const MicroOp *u) {
+    if (e.regs[u->a] == 0) {
+        return leave_block(e, u, u->pc + u->imm + 1, 0);
+    }
+    return leave_block(e, u, u->pc + 1, 1);
+}
+
+inline const MicroOp *uop_j(BlockEngine &e, const MicroOp *u) {
+    return leave_block(e, u, u->imm, 0);
+}
+
+// j to itself
+inline const MicroOp *uop_halt(BlockEngine &e, const MicroOp *u) {
+    e.m.halted = true;
+    return leave_block(e, u, u->pc, -1);
+}
+
+inline const MicroOp *uop_jal(BlockEngine &e, const MicroOp *u) {
+    e.regs[7] = u->pc + 1;
+    return leave_block(e, u, u->imm, 0);
+}
+
+inline const MicroOp *uop_jr(BlockEngine &e, const MicroOp *u) {
+    return leave_block(e, u, e.regs[u->a], -1);
+}
+
+// not an instruction: ends a block that was cut off before reaching a jump
+inline const MicroOp *uop_fallthrough(BlockEngine &e, const MicroOp *u) {
+    e.next_pc = u->pc;
+    e.exit_slot = 1;
+    e.executed = u->count;
+    return nullptr;
+}
+
+/*
+    translate_uop(d, pc, count)
+    picks the handler for one predecoded instruction
+        returns the micro-op, with fn set to the most specialized handler that applies
+    parameters:
+        d = predecoded instruction
+        pc = address of the instruction
+        count = position of the instruction in its block + 1
+ */
+inline MicroOp translate_uop(const DecodedInstr &d, uint16_t pc, uint16_t count) {
+    MicroOp u = {uop_nop, pc, count, d.imm, d.a, d.b, d.dst};
+    switch (d.op) {
+        case OP_ADD: u.fn = uop_add; break;
+        case OP_SUB: u.fn = uop_sub; break;
+        case OP_OR: u.fn = uop_or; break;
+        case OP_AND: u.fn = uop_and; break;
+        case OP_SLT: u.fn = uop_slt; break;
+        case OP_SLTI: u.fn = uop_slti; break;
+        case OP_ADDI: u.fn = (d.a == 0) ? uop_movi : uop_addi; break;
+        case OP_LW:
+            if (d.a == 0) {
+                u.fn = uop_lw_abs;
+                u.imm = d.imm & 8191;
+            }
+            else {
+                u.fn = uop_lw;
+            }
+            break;
+        case OP_SW:
+            if (d.a == 0) {
+                u.fn = uop_sw_abs;
+                u.imm = d.imm & 8191;
+            }
+            else {
+                u.fn = uop_sw;
+            }
+            break;
+        case OP_JEQ:
+            if (d.b == 0) {
+                u.fn = uop_jeqz;
+            }
+            else if (d.a == 0) {
+                u.fn = uop_jeqz;
+                u.a = d.b;
+            }
+            else {
+                u.fn = uop_jeq;
+            }
+            break;
+        case OP_J: u.fn = (d.imm == pc) ? uop_halt : uop_j; break;
+        case OP_JAL: u.fn = uop_jal; break;
+        case OP_JR: u.fn = uop_jr; break;
+        default: u.fn = uop_nop; break;
+    }
+    return u;
+}
+
+/*
+    translate_block(e, start)
+    translates the basic block starting at start and adds it to the translation cache
+        the block stops at the first jump, after MAX_BLOCK_LEN instructions,
+            or at the end of memory
+    returns the new block
+    parameters:
+        e = engine owning the translation cache
+        start = address of the first instruction, below MEM_SIZE
+ */
+inline Block *translate_block(BlockEngine &e, uint16_t start) {
+    std::unique_ptr<Block> blk(new Block());
+    blk->start = start;
+    blk->valid = true;
+    blk->link[0] = nullptr;
+    blk->link[1] = nullptr;
+    uint16_t addr = start;
+    while (true) {
+        const DecodedInstr &d = e.m.decoded[addr];
+        uint16_t count = blk->uops.size() + 1;
+        blk->uops.push_back(translate_uop(d, addr, count));
+        if (d.op == OP_J || d.op == OP_JAL || d.op == OP_JR || d.op == OP_JEQ) {
+            break;
+        }
+        if (count == MAX_BLOCK_LEN || addr == MEM_SIZE - 1) {
+            MicroOp exit = {uop_fallthrough, (uint16_t)(addr + 1), count, 0, 0, 0, 0};
+            blk->uops.push_back(exit);
+            break;
+        }
+        addr++;
+    }
+    blk->end = addr;
+    blk->length = addr - start + 1;
+    for (int i = start; i <= addr; i++) {
+        e.cover[i]++;
+    }
+    Block *b = blk.get();
+    e.blocks.push_back(std::move(blk));
+    e.cache[start] = b;
+    return b;
+}
+
+/*
+    lookup_block(e, pc)
+    finds the block starting at pc, translating it on first use
+    returns nullptr if pc is outside the 13 bit address space, which is left to step
+    parameters:
+        e = engine owning the translation cache
+        pc = program counter of the block
+ */
+inline Block *lookup_block(BlockEngine &e, uint16_t pc) {
+    if (pc >= MEM_SIZE) {
+        return nullptr;
+    }
+    Block *b = e.cache[pc];
+    if (b == nullptr) {
+        b = translate_block(e, pc);
+    }
+    return b;
+}
+
+/*
+    run_blocks(e, n)
+    executes up to n instructions of e.m a block at a time, stopping early if the program halts
+        leaves the machine in exactly the state the same number of step calls would
+        blocks that don't fit in what is left of n are run with step
+    returns the number of instructions executed (the halt included)
+    parameters:
+        e = engine wrapping the machine to run
+        n = instruction limit, RUN_UNTIL_HALT for none
+ */
+inline uint64_t run_blocks(BlockEngine &e, uint64_t n) {
+    Machine &m = e.m;
+    uint64_t count = 0;
+    Block *b = nullptr;
+    while (!m.halted && count < n) {
+        if (b == nullptr || !b->valid) {
+            b = lookup_block(e, m.pc);
+        }
+        if (b == nullptr || n - count < b->length) {
+            // a sw run here may overwrite translated code just like one in a block
+            const DecodedInstr &d = m.decoded[m.pc & 8191];
+            int store_addr = -1;
+            if (d.op == OP_SW) {
+                store_addr = (m.regs[d.a] + d.imm) & 8191;
+            }
+            step(m);
+            count++;
+            if (store_addr >= 0 && e.cover[store_addr] != 0) {
+                invalidate_code(e, store_addr);
+            }
+            b = nullptr;
+            continue;
+        }
+        e.current = b;
+        const MicroOp *u = b->uops.data();
+        u->fn(e, u);
+        count += e.executed;
+        m.pc = e.next_pc;
+        Block *next = nullptr;
+        if (e.exit_slot >= 0 && b->valid) {
+            next = b->link[e.exit_slot];
+            if (next == nullptr || !next->valid) {
+                next = lookup_block(e, m.pc);
+                b->link[e.exit_slot] = next;
+            }
+        }
+        b = next;
+        if (e.invalid_blocks > MAX_INVALID_BLOCKS) {
+            flush_blocks(e);
+            b = nullptr;
+        }
+    }
+    return count;
+}
+
+#endif // E20_BLOCK_H
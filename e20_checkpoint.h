@@ -0,0 +1,213 @@
+/*
+E20 simulator checkpoints
+e20_checkpoint.h
+
+Saves the state of a Machine to a binary file and restores it later, so
+a long run can be resumed (or restarted many times) from the middle.
+
+A checkpoint file is laid out exactly as it sits in memory:
+
+    CheckpointHeader    64 bytes: magic, version, pc, regs, ...
+    memory              MEM_SIZE 16 bit words
+    extra               extra_size bytes of front end state (simcache
+                        keeps its caches here), or nothing
+
+All fields are in the byte order of the machine that wrote the file.
+Restoring maps the file and copies the memory image straight out of
+the mapping.
+*/
+
+#ifndef E20_CHECKPOINT_H
+#define E20_CHECKPOINT_H
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "e20.h"
+#include "e20_image.h"
+
+char const static CHECKPOINT_MAGIC[8] = {'E', '2', '0', 'C', 'K', 'P', 'T', 0};
+uint32_t const static CHECKPOINT_VERSION = 1;
+// how often a run polls for a checkpoint requested by signal, in instructions
+uint64_t const static CHECKPOINT_POLL = 1 << 20;
+
+/*
+    CheckpointHeader
+    start of a checkpoint file
+        magic = CHECKPOINT_MAGIC
+        version = CHECKPOINT_VERSION
+        extra_size = number of bytes of front end state after the memory image
+        executed = instructions executed since the program was loaded
+        pc, regs = processor state
+        halted = 1 if the machine had halted
+ */
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t extra_size;
+    uint64_t executed;
+    uint16_t pc;
+    uint16_t halted;
+    uint16_t regs[NUM_REGS];
+    uint8_t reserved[20];
+};
+
+static_assert(sizeof(CheckpointHeader) == 64, "checkpoint header must stay 64 bytes");
+
+/*
+    write_checkpoint(name, m, executed, extra, error)
+    saves m to the file name, replacing it only once the new file is complete
+    returns false, with a description in error, if the file can't be written
+    parameters:
+        name = name of the checkpoint file
+        m = machine to save
+        executed = instructions executed since the program was loaded
+        extra = front end state to save along with the machine
+        error = receives the error message
+ */
+inline bool write_checkpoint(const std::string &name, const Machine &m, uint64_t executed,
+        const std::vector<uint8_t> &extra, std::string &error) {
+    CheckpointHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.extra_size = extra.size();
+    h.executed = executed;
+    h.pc = m.pc;
+    h.halted = m.halted;
+    memcpy(h.regs, m.regs, sizeof(h.regs));
+    std::string temp = name + ".tmp";
+    {
+        std::ofstream f(temp, std::ios::binary | std::ios::trunc);
+        f.write((const char *)&h, sizeof(h));
+        f.write((const char *)m.mem, sizeof(m.mem));
+        f.write((const char *)extra.data(), extra.size());
+        if (!f) {
+            error = "Can't write checkpoint " + temp;
+            return false;
+        }
+    }
+    if (rename(temp.c_str(), name.c_str()) != 0) {
+        error = "Can't write checkpoint " + name;
+        return false;
+    }
+    return true;
+}
+
+/*
+    restore_checkpoint_bytes(data, size, m, executed, extra, error)
+    restores m from the contents of a checkpoint file
+    returns false, with a description in error, if data isn't a valid checkpoint
+ */
+inline bool restore_checkpoint_bytes(const uint8_t *data, size_t size, Machine &m, uint64_t &executed,
+        std::vector<uint8_t> &extra, std::string &error) {
+    CheckpointHeader h;
+    if (size < sizeof(h) + sizeof(m.mem)) {
+        error = "Checkpoint is truncated";
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0) {
+        error = "Not a checkpoint file";
+        return false;
+    }
+    if (h.version != CHECKPOINT_VERSION) {
+        error = "Unsupported checkpoint version " + std::to_string(h.version);
+        return false;
+    }
+    if (size != sizeof(h) + sizeof(m.mem) + h.extra_size) {
+        error = "Checkpoint is truncated";
+        return false;
+    }
+    m.pc = h.pc;
+    m.halted = h.halted != 0;
+    memcpy(m.regs, h.regs, sizeof(m.regs));
+    // $0 is immutable, whatever the file says
+    m.regs[0] = 0;
+    memcpy(m.mem, data + sizeof(h), sizeof(m.mem));
+    predecode(m.mem, m.decoded);
+    const uint8_t *rest = data + sizeof(h) + sizeof(m.mem);
+    extra.assign(rest, rest + h.extra_size);
+    executed = h.executed;
+    return true;
+}
+
+/*
+    restore_checkpoint(name, m, executed, extra, error)
+    restores m from the checkpoint file name
+    returns false, with a description in error, if the file can't be read or isn't a checkpoint
+    parameters:
+        name = name of the checkpoint file
+        m = machine receiving the saved state
+        executed = receives the instructions executed before the checkpoint was taken
+        extra = receives the front end state saved with the machine
+        error = receives the error message
+ */
+inline bool restore_checkpoint(const std::string &name, Machine &m, uint64_t &executed,
+        std::vector<uint8_t> &extra, std::string &error) {
+    MappedFile file;
+    if (!file.open(name)) {
+        error = "Can't open file " + name;
+        return false;
+    }
+    return restore_checkpoint_bytes(file.data, file.size, m, executed, extra, error);
+}
+
+/*
+    checkpoint_signal()
+    flag set by SIGUSR1 to ask a running simulation for a checkpoint
+ */
+inline volatile sig_atomic_t &checkpoint_signal() {
+    static volatile sig_atomic_t requested = 0;
+    return requested;
+}
+
+inline void on_checkpoint_signal(int) {
+    checkpoint_signal() = 1;
+}
+
+/*
+    install_checkpoint_signal()
+    makes SIGUSR1 request a checkpoint, where the platform has it
+ */
+inline void install_checkpoint_signal() {
+#ifdef SIGUSR1
+    signal(SIGUSR1, on_checkpoint_signal);
+#endif
+}
+
+/*
+    run_with_checkpoints(m, executed, every, obs, save)
+    runs m until it halts, calling save() every time executed reaches a multiple of every
+        (if every isn't 0) and soon after every SIGUSR1
+    parameters:
+        m = machine being run
+        executed = instructions executed so far, kept up to date
+        every = instructions between checkpoints, 0 for none
+        obs = observer told about every lw and sw (see NoObserver)
+        save = called with no arguments to write a checkpoint
+ */
+template <typename Observer, typename Save>
+inline void run_with_checkpoints(Machine &m, uint64_t &executed, uint64_t every, Observer &obs, Save save) {
+    while (!m.halted) {
+        uint64_t slice = CHECKPOINT_POLL;
+        if (every > 0 && every - executed % every < slice) {
+            slice = every - executed % every;
+        }
+        executed += run(m, slice, obs);
+        bool due = every > 0 && executed % every == 0 && !m.halted;
+        if (checkpoint_signal()) {
+            checkpoint_signal() = 0;
+            due = true;
+        }
+        if (due) {
+            save();
+        }
+    }
+}
+
+#endif // E20_CHECKPOINT_H
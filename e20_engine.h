@@ -0,0 +1,113 @@
+/*
+E20 simulator policy-templated engine
+e20_engine.h
+
+sim and simcache run programs on the same threaded core (run in e20.h),
+specialized at compile time for the features a run has turned on:
+
+    cache model     NoObserver, or a front end's cache hierarchy
+    tracing         NoObserver, or TextTrace (e20_trace.h)
+    recording       NoObserver, or BinaryTrace (e20_trace.h)
+    statistics      NoObserver, or ExecStats (e20_stats.h)
+
+Every combination is its own instantiation of run, so a feature that is
+off costs nothing: a run with all four off is exactly run(m, n).
+*/
+
+#ifndef E20_ENGINE_H
+#define E20_ENGINE_H
+
+#include <cstdint>
+#include <type_traits>
+#include "e20.h"
+#include "e20_stats.h"
+#include "e20_trace.h"
+
+/*
+    Policies
+    observer handing every event to a cache model, a tracer, a recorder and a statistics collector,
+        in that order
+        any of the four can be NoObserver, whose calls compile away
+        cache, trace, record, stats = the four policies
+ */
+template <typename CachePolicy, typename TracePolicy, typename RecordPolicy, typename StatsPolicy>
+struct Policies {
+    static const bool sees_every_instruction = CachePolicy::sees_every_instruction ||
+        TracePolicy::sees_every_instruction || RecordPolicy::sees_every_instruction ||
+        StatsPolicy::sees_every_instruction;
+    CachePolicy &cache;
+    TracePolicy &trace;
+    RecordPolicy &record;
+    StatsPolicy &stats;
+
+    void on_instr(uint16_t pc, uint16_t instr) {
+        cache.on_instr(pc, instr);
+        trace.on_instr(pc, instr);
+        record.on_instr(pc, instr);
+        stats.on_instr(pc, instr);
+    }
+
+    void on_lw(uint16_t pc, int addr, uint16_t value) {
+        cache.on_lw(pc, addr, value);
+        trace.on_lw(pc, addr, value);
+        record.on_lw(pc, addr, value);
+        stats.on_lw(pc, addr, value);
+    }
+
+    void on_sw(uint16_t pc, int addr, uint16_t value) {
+        cache.on_sw(pc, addr, value);
+        trace.on_sw(pc, addr, value);
+        record.on_sw(pc, addr, value);
+        stats.on_sw(pc, addr, value);
+    }
+
+    void on_jeq(uint16_t pc, bool taken) {
+        cache.on_jeq(pc, taken);
+        trace.on_jeq(pc, taken);
+        record.on_jeq(pc, taken);
+        stats.on_jeq(pc, taken);
+    }
+};
+
+/*
+    with_optional(policy, f)
+    calls f(*policy), or f with a NoObserver if policy is nullptr
+ */
+template <typename Policy, typename F>
+inline void with_optional(Policy *policy, F f) {
+    if (policy != nullptr) {
+        f(*policy);
+    }
+    else {
+        NoObserver off;
+        f(off);
+    }
+}
+
+/*
+    with_policies(cache, trace, record, stats, f)
+    calls f(obs) with obs the Policies observer for the features that are on
+        trace, record and stats are off when nullptr; pass a NoObserver as cache for no cache model
+        f is typically a generic lambda running the machine with obs, e.g.
+            with_policies(caches, trace, record, stats, [&](auto &obs) { run(m, RUN_UNTIL_HALT, obs); });
+    parameters:
+        cache = cache model
+        trace = text tracer, or nullptr
+        record = binary trace recorder, or nullptr
+        stats = statistics collector, or nullptr
+        f = callable taking the observer
+ */
+template <typename CachePolicy, typename F>
+inline void with_policies(CachePolicy &cache, TextTrace *trace, BinaryTrace *record, ExecStats *stats, F f) {
+    with_optional(trace, [&](auto &t) {
+        with_optional(record, [&](auto &r) {
+            with_optional(stats, [&](auto &s) {
+                Policies<CachePolicy, typename std::decay<decltype(t)>::type, typename std::decay<decltype(r)>::type,
+                    typename std::decay<decltype(s)>::type> obs = {cache, t, r, s};
+                f(obs);
+            });
+        });
+    });
+}
+
+#endif // E20_ENGINE_H
@@ -0,0 +1,417 @@
+/*
+E20 simulator ensemble engine
+e20_ensemble.h
+
+Runs many E20 machines in lockstep, e.g. one program started from many
+different memory images. The machines are kept in structure-of-arrays
+form: for every register and every memory cell, the values of all
+instances sit next to each other, one 16 bit lane per instance.
+
+Each step picks the lowest pc among the instances still running and
+executes the instruction there for every instance at that pc, a vector
+of lanes at a time. Instances whose control flow has diverged simply sit
+out the steps for other pcs until they meet up again, so an instance
+running alone degrades to running one lane at a time. Instances at the
+same pc holding different words there (different images, or code that
+rewrote itself) are executed one distinct word at a time.
+
+With GCC or Clang on x86-64 the lane kernel is compiled twice, for AVX2
+and for SSE2, and the AVX2 one is used when the CPU has it. Other
+compilers get the same kernel one lane at a time.
+*/
+
+#ifndef E20_ENSEMBLE_H
+#define E20_ENSEMBLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "e20.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define E20_LANE_VECTORS 1
+#else
+#define E20_LANE_VECTORS 0
+#endif
+
+#if E20_LANE_VECTORS && defined(__x86_64__)
+#define E20_ENSEMBLE_AVX2 1
+#else
+#define E20_ENSEMBLE_AVX2 0
+#endif
+
+#if E20_LANE_VECTORS
+// the lane helpers are always inlined, so the ABI for passing vectors never comes into it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+// 16 lanes of 16 bits: one AVX2 register, or two SSE2 registers
+typedef uint16_t LaneVec __attribute__((vector_size(32)));
+#define E20_LANE_INLINE inline __attribute__((always_inline))
+#else
+typedef uint16_t LaneVec;
+#define E20_LANE_INLINE inline
+#endif
+
+// the lane count is rounded up to a multiple of this, so the kernel never needs a tail loop
+size_t const static ENSEMBLE_WIDTH = sizeof(LaneVec) / sizeof(uint16_t);
+
+// states of Ensemble::code
+uint8_t const static CODE_STALE = 0;    // not checked since the last store to the cell
+uint8_t const static CODE_UNIFORM = 1;  // every instance holds the same word, decoded in Ensemble::decoded
+uint8_t const static CODE_MIXED = 2;    // instances hold different words
+
+/*
+    Ensemble
+    state of many E20 machines, one lane per machine
+        instances = number of machines
+        lanes = instances rounded up to a multiple of ENSEMBLE_WIDTH; the extra lanes never run
+        pc[lane] = program counter of each machine
+        running[lane] = 0xFFFF until the machine halts, then 0
+        pending[lane] = scratch mask used while executing a cell the instances disagree on
+        regs[reg * lanes + lane] = registers
+        mem[addr * lanes + lane] = memory cells
+        code[addr] = whether the instances agree on the word at addr (CODE_*)
+        decoded[addr] = the decoded word at addr when code[addr] is CODE_UNIFORM
+        use_avx2 = whether the AVX2 kernel is used
+ */
+struct Ensemble {
+    size_t instances;
+    size_t lanes;
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> running;
+    std::vector<uint16_t> pending;
+    std::vector<uint16_t> regs;
+    std::vector<uint16_t> mem;
+    uint8_t code[MEM_SIZE];
+    DecodedInstr decoded[MEM_SIZE];
+    bool use_avx2;
+
+    explicit Ensemble(size_t n) : instances(n),
+            lanes((n + ENSEMBLE_WIDTH - 1) / ENSEMBLE_WIDTH * ENSEMBLE_WIDTH),
+            pc(lanes, 0), running(lanes, 0), pending(lanes, 0),
+            regs(NUM_REGS * lanes, 0), mem(MEM_SIZE * lanes, 0), use_avx2(false) {
+        memset(code, CODE_STALE, sizeof(code));
+#if E20_ENSEMBLE_AVX2
+        use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+};
+
+/*
+    ensemble_load(e, lane, m)
+    copies machine m into one lane of e
+    parameters:
+        e = ensemble receiving the machine
+        lane = lane to fill, below e.instances
+        m = machine to copy
+ */
+inline void ensemble_load(Ensemble &e, size_t lane, const Machine &m) {
+    e.pc[lane] = m.pc;
+    e.running[lane] = m.halted ? 0 : 0xFFFF;
+    for (size_t r = 0; r < NUM_REGS; r++) {
+        e.regs[r * e.lanes + lane] = m.regs[r];
+    }
+    for (size_t addr = 0; addr < MEM_SIZE; addr++) {
+        e.mem[addr * e.lanes + lane] = m.mem[addr];
+        e.code[addr] = CODE_STALE;
+    }
+}
+
+/*
+    ensemble_store(e, lane, m)
+    copies one lane of e out into machine m
+    parameters:
+        e = ensemble holding the machine
+        lane = lane to copy, below e.instances
+        m = machine receiving the lane's pc, registers, memory and halted flag
+ */
+inline void ensemble_store(const Ensemble &e, size_t lane, Machine &m) {
+    m.pc = e.pc[lane];
+    m.halted = e.running[lane] == 0;
+    for (size_t r = 0; r < NUM_REGS; r++) {
+        m.regs[r] = e.regs[r * e.lanes + lane];
+    }
+    for (size_t addr = 0; addr < MEM_SIZE; addr++) {
+        m.mem[addr] = e.mem[addr * e.lanes + lane];
+    }
+    predecode(m.mem, m.decoded);
+}
+
+/*
+    ensemble_check_code(e, addr)
+    finds out whether every instance holds the same word at addr
+        and decodes it if so
+    returns the new state of the cell (CODE_UNIFORM or CODE_MIXED)
+    parameters:
+        e = ensemble to check
+        addr = memory address, below MEM_SIZE
+ */
+inline uint8_t ensemble_check_code(Ensemble &e, size_t addr) {
+    const uint16_t *row = &e.mem[addr * e.lanes];
+    uint8_t state = CODE_UNIFORM;
+    for (size_t lane = 1; lane < e.instances; lane++) {
+        if (row[lane] != row[0]) {
+            state = CODE_MIXED;
+            break;
+        }
+    }
+    if (state == CODE_UNIFORM) {
+        e.decoded[addr] = decode(row[0]);
+    }
+    e.code[addr] = state;
+    return state;
+}
+
+/*
+    lane_load(p) / lane_store(p, v)
+    move ENSEMBLE_WIDTH lanes between memory and a LaneVec, with no alignment needed
+ */
+E20_LANE_INLINE LaneVec lane_load(const uint16_t *p) {
+    LaneVec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+E20_LANE_INLINE void lane_store(uint16_t *p, const LaneVec &v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+// turns a lane comparison into 0xFFFF where it holds and 0 where it doesn't,
+    // for vectors (where true is -1) and single lanes (where true is 1) alike
+#define LANE_MASK(cmp) ((LaneVec)(zero - (LaneVec)((cmp) & 1)))
+
+/*
+    ensemble_kernel(e, d, cur, filter, word)
+    executes instruction d for every running instance at pc cur
+        if filter is set, only for the instances in e.pending holding word at cur,
+            which are then taken out of e.pending
+    returns the lowest pc among the instances still running afterwards, 0xFFFF if none
+        (an instance running at pc 0xFFFF is found by ensemble_run anyway)
+    parameters:
+        e = ensemble being stepped
+        d = decoded instruction to execute
+        cur = pc being executed
+        filter = whether to go by e.pending and word
+        word = word the executed instances hold at cur, when filter is set
+ */
+E20_LANE_INLINE uint16_t ensemble_kernel(Ensemble &e, const DecodedInstr &d, uint16_t cur,
+        bool filter, uint16_t word) {
+    const size_t lanes = e.lanes;
+    const LaneVec zero = LaneVec();
+    const LaneVec all = zero + (uint16_t)0xFFFF;
+    const LaneVec imm = zero + d.imm;
+    const uint16_t *row = &e.mem[(cur & 8191) * lanes];
+    uint16_t *ra = &e.regs[d.a * lanes];
+    uint16_t *rb = &e.regs[d.b * lanes];
+    // jal's link register isn't in the decoded record
+    uint16_t *rd = &e.regs[(d.op == OP_JAL ? 7 : d.dst) * lanes];
+    LaneVec lowest = all;
+    for (size_t base = 0; base < lanes; base += ENSEMBLE_WIDTH) {
+        LaneVec pcv = lane_load(&e.pc[base]);
+        LaneVec run = lane_load(&e.running[base]);
+        LaneVec m;
+        if (filter) {
+            LaneVec pend = lane_load(&e.pending[base]);
+            m = pend & LANE_MASK(lane_load(&row[base]) == (zero + word));
+            lane_store(&e.pending[base], pend & ~m);
+        }
+        else {
+            m = run & LANE_MASK(pcv == (zero + cur));
+        }
+        LaneVec next = pcv + (uint16_t)1;
+        LaneVec result = zero;
+        bool writes = true;
+        switch (d.op) {
+            case OP_ADD:
+                result = lane_load(&ra[base]) + lane_load(&rb[base]);
+                break;
+            case OP_SUB:
+                result = lane_load(&ra[base]) - lane_load(&rb[base]);
+                break;
+            case OP_OR:
+                result = lane_load(&ra[base]) | lane_load(&rb[base]);
+                break;
+            case OP_AND:
+                result = lane_load(&ra[base]) & lane_load(&rb[base]);
+                break;
+            case OP_SLT:
+                result = LANE_MASK(lane_load(&ra[base]) < lane_load(&rb[base])) & (uint16_t)1;
+                break;
+            case OP_SLTI:
+                result = LANE_MASK(lane_load(&ra[base]) < imm) & (uint16_t)1;
+                break;
+            case OP_ADDI:
+                result = lane_load(&ra[base]) + imm;
+                break;
+            case OP_LW:
+            case OP_SW: {
+                // gathers and scatters: one lane at a time
+                uint16_t mask[ENSEMBLE_WIDTH];
+                uint16_t out[ENSEMBLE_WIDTH];
+                lane_store(mask, m);
+                lane_store(out, lane_load(&rd[base]));
+                for (size_t i = 0; i < ENSEMBLE_WIDTH; i++) {
+                    if (mask[i]) {
+                        size_t addr = (uint16_t)(ra[base + i] + d.imm) & 8191;
+                        uint16_t *cell = &e.mem[addr * lanes + base + i];
+                        if (d.op == OP_LW) {
+                            out[i] = *cell;
+                        }
+                        else {
+                            *cell = rb[base + i];
+                            // the stored word may be executed later
+                            e.code[addr] = CODE_STALE;
+                        }
+                    }
+                }
+                result = lane_load(out);
+                writes = d.op == OP_LW;
+                break;
+            }
+            case OP_JR:
+                next = lane_load(&ra[base]);
+                writes = false;
+                break;
+            case OP_JEQ: {
+                LaneVec taken = LANE_MASK(lane_load(&ra[base]) == lane_load(&rb[base]));
+                next = (next & ~taken) | ((pcv + imm + (uint16_t)1) & taken);
+                writes = false;
+                break;
+            }
+            case OP_J:
+                next = imm;
+                // j to itself is a halt
+                if (d.imm == cur) {
+                    run = run & ~m;
+                    lane_store(&e.running[base], run);
+                }
+                writes = false;
+                break;
+            case OP_JAL:
+                result = next;
+                next = imm;
+                break;
+            default: // OP_NOP
+                writes = false;
+                break;
+        }
+        if (writes) {
+            lane_store(&rd[base], (result & m) | (lane_load(&rd[base]) & ~m));
+        }
+        pcv = (next & m) | (pcv & ~m);
+        lane_store(&e.pc[base], pcv);
+        // halted lanes count as 0xFFFF
+        LaneVec key = pcv | ~run;
+        LaneVec lower = LANE_MASK(key < lowest);
+        lowest = (key & lower) | (lowest & ~lower);
+    }
+    uint16_t lows[ENSEMBLE_WIDTH];
+    lane_store(lows, lowest);
+    uint16_t low = 0xFFFF;
+    for (size_t i = 0; i < ENSEMBLE_WIDTH; i++) {
+        if (lows[i] < low) {
+            low = lows[i];
+        }
+    }
+    return low;
+}
+
+#undef LANE_MASK
+
+#if E20_ENSEMBLE_AVX2
+__attribute__((target("avx2"))) inline uint16_t ensemble_kernel_avx2(Ensemble &e,
+        const DecodedInstr &d, uint16_t cur, bool filter, uint16_t word) {
+    return ensemble_kernel(e, d, cur, filter, word);
+}
+#endif
+
+/*
+    ensemble_exec(e, d, cur, filter, word)
+    runs ensemble_kernel with the widest instruction set the CPU supports
+ */
+inline uint16_t ensemble_exec(Ensemble &e, const DecodedInstr &d, uint16_t cur, bool filter, uint16_t word) {
+#if E20_ENSEMBLE_AVX2
+    if (e.use_avx2) {
+        return ensemble_kernel_avx2(e, d, cur, filter, word);
+    }
+#endif
+    return ensemble_kernel(e, d, cur, filter, word);
+}
+
+/*
+    ensemble_lowest_pc(e, low)
+    finds the lowest pc among the running instances
+    returns false if no instance is running
+    parameters:
+        e = ensemble to search
+        low = receives the lowest pc
+ */
+inline bool ensemble_lowest_pc(const Ensemble &e, uint16_t &low) {
+    bool any = false;
+    for (size_t lane = 0; lane < e.instances; lane++) {
+        if (e.running[lane] && (!any || e.pc[lane] < low)) {
+            low = e.pc[lane];
+            any = true;
+        }
+    }
+    return any;
+}
+
+/*
+    ensemble_run(e, n)
+    runs the instances until all of them have halted, or for n steps
+        each step executes one instruction in every instance at the lowest running pc
+        every instance ends up in exactly the state step would have left it in
+    returns the number of steps taken
+    parameters:
+        e = ensemble to run
+        n = step limit, RUN_UNTIL_HALT for none
+ */
+inline uint64_t ensemble_run(Ensemble &e, uint64_t n) {
+    uint16_t cur = 0;
+    if (!ensemble_lowest_pc(e, cur)) {
+        return 0;
+    }
+    uint64_t count = 0;
+    while (count < n) {
+        count++;
+        size_t cell = cur & 8191;
+        uint8_t state = e.code[cell];
+        if (state == CODE_STALE) {
+            state = ensemble_check_code(e, cell);
+        }
+        uint16_t low;
+        if (state == CODE_UNIFORM) {
+            low = ensemble_exec(e, e.decoded[cell], cur, false, 0);
+        }
+        else {
+            // the instances at cur disagree on the word there: execute each distinct word in turn
+            const uint16_t *row = &e.mem[cell * e.lanes];
+            std::vector<uint16_t> words;
+            for (size_t lane = 0; lane < e.lanes; lane++) {
+                bool here = e.running[lane] && e.pc[lane] == cur;
+                e.pending[lane] = here ? 0xFFFF : 0;
+                if (here && std::find(words.begin(), words.end(), row[lane]) == words.end()) {
+                    words.push_back(row[lane]);
+                }
+            }
+            for (uint16_t word : words) {
+                ensemble_exec(e, decode(word), cur, true, word);
+            }
+            low = 0xFFFF;
+        }
+        // 0xFFFF is also what no running instance looks like
+        if (low == 0xFFFF && !ensemble_lowest_pc(e, low)) {
+            break;
+        }
+        cur = low;
+    }
+    return count;
+}
+
+#if E20_LANE_VECTORS
+#pragma GCC diagnostic pop
+#endif
+
+#endif // E20_ENSEMBLE_H
@@ -0,0 +1,276 @@
+/*
+E20 simulator binary images
+e20_image.h
+
+Loads programs in either of the two machine code formats:
+
+    text    ram[N] = 16'b...; lines, as written by asm by default
+    .e20bin binary image, as written by asm --e20bin
+
+An .e20bin file is mapped into memory and copied into the machine
+without any parsing. Its layout, all fields little-endian:
+
+    offset  size
+    0       8       magic "E20BIN\0\0"
+    8       4       version (IMAGE_VERSION)
+    12      4       length: number of words loaded, at most MEM_SIZE
+    16      2       entry pc
+    18      2       reserved, 0
+    20      4       size in bytes of the symbol section
+    24      8       reserved, 0
+    32      2*length    the words, loaded at addresses 0 to length - 1
+    ...     symbols     for each symbol: address (2 bytes), name length
+                        (2 bytes), name (no terminator)
+*/
+
+#ifndef E20_IMAGE_H
+#define E20_IMAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "e20.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define E20_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define E20_HAVE_MMAP 0
+#include <iterator>
+#endif
+
+char const static IMAGE_MAGIC[8] = {'E', '2', '0', 'B', 'I', 'N', 0, 0};
+uint32_t const static IMAGE_VERSION = 1;
+size_t const static IMAGE_HEADER_SIZE = 32;
+
+/*
+    ImageSymbol
+    a named address carried in an .e20bin file (asm writes every label)
+ */
+struct ImageSymbol {
+    uint16_t address;
+    std::string name;
+};
+
+/*
+    MappedFile
+    read-only view of a whole file, mapped where the platform supports it and read in otherwise
+        data, size = the contents of the file
+ */
+struct MappedFile {
+    const uint8_t *data;
+    size_t size;
+#if E20_HAVE_MMAP
+    void *mapping;
+#else
+    std::vector<uint8_t> contents;
+#endif
+
+    MappedFile() : data(nullptr), size(0)
+#if E20_HAVE_MMAP
+            , mapping(nullptr)
+#endif
+    {}
+
+    ~MappedFile() {
+#if E20_HAVE_MMAP
+        if (mapping != nullptr) {
+            munmap(mapping, size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /*
+        open(name)
+        maps the file name
+        returns false if it can't be opened
+     */
+    bool open(const std::string &name) {
+#if E20_HAVE_MMAP
+        int fd = ::open(name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = p != MAP_FAILED;
+            if (ok) {
+                mapping = p;
+                data = (const uint8_t *)p;
+                size = st.st_size;
+            }
+        }
+        ::close(fd);
+        return ok;
+#else
+        std::ifstream f(name, std::ios::binary);
+        if (!f.is_open()) {
+            return false;
+        }
+        contents.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        data = contents.data();
+        size = contents.size();
+        return true;
+#endif
+    }
+};
+
+// little-endian fields of an .e20bin file
+inline uint16_t image_get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+inline uint32_t image_get32(const uint8_t *p) {
+    return image_get16(p) | ((uint32_t)image_get16(p + 2) << 16);
+}
+
+inline void image_put16(std::string &out, uint16_t v) {
+    out += (char)(v & 255);
+    out += (char)(v >> 8);
+}
+
+inline void image_put32(std::string &out, uint32_t v) {
+    image_put16(out, v & 0xFFFF);
+    image_put16(out, v >> 16);
+}
+
+/*
+    is_image(data, size)
+    returns true if data starts like an .e20bin file
+ */
+inline bool is_image(const uint8_t *data, size_t size) {
+    return size >= sizeof(IMAGE_MAGIC) && memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0;
+}
+
+/*
+    load_image_bytes(data, size, m, error, symbols)
+    loads the contents of an .e20bin file into m: its words into memory, starting
+        at address 0, and its entry point into the pc
+    returns false, with a description in error, if data isn't a valid image
+    parameters:
+        data, size = contents of the file
+        m = machine to load into
+        error = receives the error message
+        symbols = receives the symbols, unless nullptr
+ */
+inline bool load_image_bytes(const uint8_t *data, size_t size, Machine &m, std::string &error,
+        std::vector<ImageSymbol> *symbols = nullptr) {
+    if (size < IMAGE_HEADER_SIZE || !is_image(data, size)) {
+        error = "Not an .e20bin image";
+        return false;
+    }
+    uint32_t version = image_get32(data + 8);
+    if (version != IMAGE_VERSION) {
+        error = "Unsupported .e20bin version " + std::to_string(version);
+        return false;
+    }
+    uint32_t length = image_get32(data + 12);
+    uint32_t symbols_size = image_get32(data + 20);
+    if (length > MEM_SIZE) {
+        error = "Program too big for memory";
+        return false;
+    }
+    if (size != IMAGE_HEADER_SIZE + 2 * (size_t)length + symbols_size) {
+        error = "Image is truncated";
+        return false;
+    }
+    const uint8_t *words = data + IMAGE_HEADER_SIZE;
+    for (uint32_t addr = 0; addr < length; addr++) {
+        m.mem[addr] = image_get16(words + 2 * addr);
+    }
+    m.pc = image_get16(data + 16);
+    predecode(m.mem, m.decoded);
+    if (symbols != nullptr) {
+        symbols->clear();
+        const uint8_t *p = words + 2 * length;
+        const uint8_t *end = p + symbols_size;
+        while (p < end) {
+            if (end - p < 4 || end - p - 4 < image_get16(p + 2)) {
+                error = "Image has a malformed symbol section";
+                return false;
+            }
+            ImageSymbol sym = {image_get16(p), std::string((const char *)p + 4, image_get16(p + 2))};
+            symbols->push_back(sym);
+            p += 4 + image_get16(p + 2);
+        }
+    }
+    return true;
+}
+
+/*
+    write_image(name, words, entry, symbols, error)
+    writes an .e20bin file
+    returns false, with a description in error, if it can't be written
+    parameters:
+        name = name of the file
+        words = memory contents from address 0, at most MEM_SIZE words
+        entry = pc to start at
+        symbols = symbols to include
+        error = receives the error message
+ */
+inline bool write_image(const std::string &name, const std::vector<uint16_t> &words, uint16_t entry,
+        const std::vector<ImageSymbol> &symbols, std::string &error) {
+    if (words.size() > MEM_SIZE) {
+        error = "Program too big for memory";
+        return false;
+    }
+    std::string syms;
+    for (const ImageSymbol &sym : symbols) {
+        image_put16(syms, sym.address);
+        image_put16(syms, sym.name.size());
+        syms += sym.name;
+    }
+    std::string out(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    image_put32(out, IMAGE_VERSION);
+    image_put32(out, words.size());
+    image_put16(out, entry);
+    image_put16(out, 0);
+    image_put32(out, syms.size());
+    out.append(8, '\0');
+    for (uint16_t w : words) {
+        image_put16(out, w);
+    }
+    out += syms;
+    std::ofstream f(name, std::ios::binary | std::ios::trunc);
+    f.write(out.data(), out.size());
+    if (!f) {
+        error = "Can't write file " + name;
+        return false;
+    }
+    return true;
+}
+
+/*
+    load_program(name, m, error, symbols)
+    loads the machine code file name into m, in either format
+    returns false, with a description in error, if the file can't be opened or is malformed
+    parameters:
+        name = name of the file
+        m = machine to load into
+        error = receives the error message
+        symbols = receives the symbols of an .e20bin file, unless nullptr
+ */
+inline bool load_program(const std::string &name, Machine &m, std::string &error,
+        std::vector<ImageSymbol> *symbols = nullptr) {
+    MappedFile file;
+    if (!file.open(name)) {
+        error = "Can't open file " + name;
+        return false;
+    }
+    if (is_image(file.data, file.size)) {
+        return load_image_bytes(file.data, file.size, m, error, symbols);
+    }
+    return parse_machine_code_bytes((const char *)file.data, file.size, m, error);
+}
+
+#endif // E20_IMAGE_H
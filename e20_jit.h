@@ -0,0 +1,837 @@
+/*
+E20 simulator JIT backend
+e20_jit.h
+
+Compiles hot basic blocks of E20 code to native x86-64 code in mmap'd
+executable memory (Linux only). Cold code runs on the interpreter
+(step); a block is compiled once its start address has been reached
+JIT_DEFAULT_THRESHOLD times.
+
+Inside compiled code the guest registers $1-$7 live in host registers
+r8d-r14d, zero-extended to 32 bits; $0 is never kept in a register and
+reads as zero. Every address is masked to 13 bits before it is used,
+just like in execute. Writes to $0 never reach compiled code, since the
+decoder already turns them into OP_NOP. r15 holds how many more
+instructions may run before control goes back to the engine.
+
+A block whose exit has a fixed target (j, jal, jeq, falling through)
+jumps straight into the compiled block at that target, once there is
+one, keeping the guest registers where they are. A block that doesn't
+fit in what is left of r15 returns to the engine instead.
+
+The code memory is never writable and executable at once, so a stray
+store can't become native code. It is read/execute, and mprotect makes
+just the pages being written read/write while a block is emitted or
+exits are relinked, when no compiled code is running. The exits are
+indexed by target, so compiling or dropping a block only visits the
+exits into it.
+
+A store from compiled code doesn't re-decode the cell it wrote. It marks
+the cell dirty in JitEngine::state instead, and the engine re-decodes
+dirty cells before interpreting them and when the run ends. A store
+into a cell covered by a compiled block returns to the engine right
+away, so the engine can drop the overwritten block before anything runs
+it.
+*/
+
+#ifndef E20_JIT_H
+#define E20_JIT_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "e20.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define E20_HAVE_JIT 1
+#include <sys/mman.h>
+#else
+#define E20_HAVE_JIT 0
+#endif
+
+// times a block start must be reached before it is compiled
+uint32_t const static JIT_DEFAULT_THRESHOLD = 16;
+// longest run of instructions compiled into one block
+size_t const static MAX_JIT_BLOCK_LEN = 64;
+// memory reserved for compiled code; it is all thrown away when it fills up
+size_t const static JIT_CODE_SIZE = 4 << 20;
+// granularity of jit_protect
+uintptr_t const static JIT_PAGE_SIZE = 4096;
+
+// bits of JitEngine::state
+uint8_t const static JIT_DIRTY = 1;    // written by compiled code, decoded[] is stale
+uint8_t const static JIT_WATCHED = 2;  // covered by at least one compiled block
+
+// compiled code returns the pc to continue at in the low 16 bits
+    // when it stopped because of a store into compiled code, bit 31 is set
+    // and the address stored to is in bits 16-28
+typedef uint32_t (*JitFn)();
+uint32_t const static JIT_EXIT_STORE = 1u << 31;
+
+/*
+    JitBlock
+    one compiled basic block
+        start, end = first and last address covered (inclusive)
+        fn = entry point called by the engine
+        body = entry point jumped to by other blocks, skipping the prologue
+        length = number of instructions in the block
+ */
+struct JitBlock {
+    uint16_t start;
+    uint16_t end;
+    JitFn fn;
+    uint8_t *body;
+    uint32_t length;
+};
+
+/*
+    JitLink
+    exit of a compiled block whose target is known
+        site = rel32 of the jmp that goes to the target block, or to the next instruction
+            (the return to the engine) while the target isn't compiled
+        target = pc the exit continues at
+ */
+struct JitLink {
+    uint8_t *site;
+    uint16_t target;
+};
+
+/*
+    JitEngine
+    compiled code and bookkeeping for running one Machine with the JIT
+        m = machine being run
+        threshold = times a block start is reached before it is compiled
+        linking = whether blocks may jump straight into each other
+        budget = instruction budget handed to and returned by compiled code
+        code, code_used = memory for compiled code (read/execute except while jit_protect
+            has it writable) and how much of it is filled
+        compiled[] = block starting at each address, or nullptr
+        cover[] = number of compiled blocks containing each address
+        state[] = JIT_DIRTY / JIT_WATCHED bits for each address
+        heat[] = times each address has been reached by the interpreter
+        blocks = owns every compiled block
+        links[] = the exits with a known target, by target, for linking and unlinking;
+            exits to addresses past the end of memory are left out, since nothing is compiled there
+ */
+struct JitEngine {
+    Machine &m;
+    uint32_t threshold;
+    bool linking;
+    uint64_t budget;
+    uint8_t *code;
+    size_t code_used;
+    JitBlock *compiled[MEM_SIZE];
+    uint16_t cover[MEM_SIZE];
+    uint8_t state[MEM_SIZE];
+    uint32_t heat[MEM_SIZE];
+    std::vector<std::unique_ptr<JitBlock>> blocks;
+    std::vector<JitLink> links[MEM_SIZE];
+
+    explicit JitEngine(Machine &machine) : m(machine), threshold(JIT_DEFAULT_THRESHOLD),
+            linking(true), budget(0), code(nullptr), code_used(0) {
+        for (size_t i = 0; i < MEM_SIZE; i++) {
+            compiled[i] = nullptr;
+            cover[i] = 0;
+            state[i] = 0;
+            heat[i] = 0;
+        }
+#if E20_HAVE_JIT
+        void *p = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        // no JIT where the memory can't be made executable
+        if (p != MAP_FAILED && mprotect(p, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) == 0) {
+            code = (uint8_t *)p;
+        }
+        else if (p != MAP_FAILED) {
+            munmap(p, JIT_CODE_SIZE);
+        }
+#endif
+    }
+
+    ~JitEngine() {
+#if E20_HAVE_JIT
+        if (code != nullptr) {
+            munmap(code, JIT_CODE_SIZE);
+        }
+#endif
+    }
+
+    JitEngine(const JitEngine &) = delete;
+    JitEngine &operator=(const JitEngine &) = delete;
+};
+
+/*
+    jit_available(e)
+    returns true if e got executable memory to compile into
+    parameters:
+        e = engine to check
+ */
+inline bool jit_available(const JitEngine &e) {
+    return e.code != nullptr;
+}
+
+/*
+    jit_protect(from, to, writable)
+    makes the pages of compiled code holding from up to to writable, and not executable,
+        for emitting or patching code there, or executable, and not writable, again to run it
+        only the pages written are flipped, since the cost grows with the pages changed
+        JitEngine's constructor has already checked that the memory can be made executable
+    parameters:
+        from, to = first byte and one past the last byte that will be (or were) written
+        writable = true to write the code, false to run it
+ */
+inline void jit_protect(const uint8_t *from, const uint8_t *to, bool writable) {
+#if E20_HAVE_JIT
+    uintptr_t first = (uintptr_t)from & ~(JIT_PAGE_SIZE - 1);
+    uintptr_t last = ((uintptr_t)to + JIT_PAGE_SIZE - 1) & ~(JIT_PAGE_SIZE - 1);
+    mprotect((void *)first, last - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+#else
+    (void)from;
+    (void)to;
+    (void)writable;
+#endif
+}
+
+/*
+    jit_span(links, from, to)
+    widens the range from..to (empty while from is nullptr) to cover the exits in links
+ */
+inline void jit_span(const std::vector<JitLink> &links, uint8_t *&from, uint8_t *&to) {
+    for (const JitLink &link : links) {
+        if (from == nullptr || link.site < from) {
+            from = link.site;
+        }
+        if (to == nullptr || link.site + 4 > to) {
+            to = link.site + 4;
+        }
+    }
+}
+
+/*
+    X86Emitter
+    growable buffer of x86-64 machine code
+        only the handful of instruction forms the JIT needs are provided
+        registers are numbered the way the hardware numbers them (0 = rax ... 15 = r15)
+ */
+struct X86Emitter {
+    std::vector<uint8_t> out;
+
+    void byte(uint8_t b) {
+        out.push_back(b);
+    }
+
+    void dword(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            byte(v >> (8 * i));
+        }
+    }
+
+    void qword(uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+            byte(v >> (8 * i));
+        }
+    }
+
+    // REX prefix for 32 bit operands, left out when no extended register is used
+    void rex(int reg, int index, int base) {
+        uint8_t r = 0x40 | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (r != 0x40) {
+            byte(r);
+        }
+    }
+
+    // op r/m32, r32 with both operands registers (add 01, or 09, and 21, sub 29, xor 31, cmp 39, mov 89)
+    void alu_rr(uint8_t opc, int dst, int src) {
+        rex(src, 0, dst);
+        byte(opc);
+        byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+
+    // op r/m32, imm32 (ext: add 0, or 1, and 4, sub 5, cmp 7)
+    void alu_ri(int ext, int dst, uint32_t imm) {
+        rex(0, 0, dst);
+        byte(0x81);
+        byte(0xC0 | (ext << 3) | (dst & 7));
+        dword(imm);
+    }
+
+    // op r15, imm32 on all 64 bits (same ext as alu_ri)
+    void alu_r15_imm(int ext, uint32_t imm) {
+        byte(0x49);
+        byte(0x81);
+        byte(0xC0 | (ext << 3) | 7);
+        dword(imm);
+    }
+
+    // mov r32, imm32
+    void mov_ri(int dst, uint32_t imm) {
+        rex(0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+
+    // movabs r64, imm64
+    void mov_ri64(int dst, uint64_t imm) {
+        byte(0x48 | (dst >> 3));
+        byte(0xB8 + (dst & 7));
+        qword(imm);
+    }
+
+    // movzx r32, r16
+    void movzx16(int dst, int src) {
+        rex(dst, 0, src);
+        byte(0x0F);
+        byte(0xB7);
+        byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    // setb al; movzx eax, al
+    void setb_eax() {
+        byte(0x0F); byte(0x92); byte(0xC0);
+        byte(0x0F); byte(0xB6); byte(0xC0);
+    }
+
+    // movzx r32, word [rdi + disp8]
+    void load_rdi16(int dst, uint8_t disp) {
+        rex(dst, 0, 0);
+        byte(0x0F);
+        byte(0xB7);
+        byte(0x40 | ((dst & 7) << 3) | 7);
+        byte(disp);
+    }
+
+    // mov word [rdi + disp8], r16
+    void store_rdi16(uint8_t disp, int src) {
+        byte(0x66);
+        rex(src, 0, 0);
+        byte(0x89);
+        byte(0x40 | ((src & 7) << 3) | 7);
+        byte(disp);
+    }
+
+    void push(int r) {
+        rex(0, 0, r);
+        byte(0x50 + (r & 7));
+    }
+
+    void pop(int r) {
+        rex(0, 0, r);
+        byte(0x58 + (r & 7));
+    }
+
+    // jcc rel32 (cc: b 0x82, ae 0x83, e 0x84, ne 0x85), returns the offset of the displacement to patch
+    size_t jcc(uint8_t cc) {
+        byte(0x0F);
+        byte(cc);
+        dword(0);
+        return out.size() - 4;
+    }
+
+    // jmp rel32, returns the offset of the displacement to patch
+    size_t jmp() {
+        byte(0xE9);
+        dword(0);
+        return out.size() - 4;
+    }
+
+    // points the rel32 displacement at offset at to the offset target
+    void patch(size_t at, size_t target) {
+        uint32_t rel = target - (at + 4);
+        memcpy(&out[at], &rel, 4);
+    }
+
+    void patch_here(size_t at) {
+        patch(at, out.size());
+    }
+};
+
+// host register numbers used by compiled code
+int const static HOST_EAX = 0;      // scratch, and the value returned to the engine
+int const static HOST_ECX = 1;      // scratch
+int const static HOST_RDX = 2;      // base of JitEngine::state
+int const static HOST_RSI = 6;      // base of Machine::mem
+int const static HOST_RDI = 7;      // base of Machine::regs
+
+/*
+    JitBuild
+    a block being compiled
+        x = its code
+        length = number of instructions in the block
+        to_exit = jmps to patch to the block's shared exit
+        links = exits with a known target, as (rel32 offset, target pc)
+ */
+struct JitBuild {
+    X86Emitter x;
+    uint32_t length;
+    std::vector<size_t> to_exit;
+    std::vector<std::pair<size_t, uint16_t>> links;
+};
+
+/*
+    guest_reg(g)
+    returns the host register pinned to guest register $g (g = 1..7)
+ */
+inline int guest_reg(int g) {
+    return 7 + g;
+}
+
+/*
+    emit_read_guest(x, scratch, g)
+    puts the value of guest register $g in the scratch register
+ */
+inline void emit_read_guest(X86Emitter &x, int scratch, int g) {
+    if (g == 0) {
+        x.alu_rr(0x31, scratch, scratch);
+    }
+    else {
+        x.alu_rr(0x89, scratch, guest_reg(g));
+    }
+}
+
+/*
+    emit_write_guest(x, g)
+    truncates eax to 16 bits and copies it into guest register $g (g != 0)
+ */
+inline void emit_write_guest(X86Emitter &x, int g) {
+    x.movzx16(HOST_EAX, HOST_EAX);
+    x.alu_rr(0x89, guest_reg(g), HOST_EAX);
+}
+
+/*
+    emit_return(b, value)
+    returns value (see JitFn) to the engine through the block's shared exit
+ */
+inline void emit_return(JitBuild &b, uint32_t value) {
+    b.x.mov_ri(HOST_EAX, value);
+    b.to_exit.push_back(b.x.jmp());
+}
+
+/*
+    emit_exit_to(b, next_pc)
+    leaves the block for the fixed target next_pc
+        the leading jmp falls through to the return while next_pc isn't compiled,
+        and is pointed at the compiled block once it is (see jit_link)
+ */
+inline void emit_exit_to(JitBuild &b, uint16_t next_pc) {
+    size_t site = b.x.jmp();
+    b.x.patch_here(site);
+    b.links.push_back(std::make_pair(site, next_pc));
+    emit_return(b, next_pc);
+}
+
+/*
+    emit_address(x, d)
+    leaves the wrapped address regs[d.a] + d.imm of a lw/sw in eax
+ */
+inline void emit_address(X86Emitter &x, const DecodedInstr &d) {
+    emit_read_guest(x, HOST_EAX, d.a);
+    x.alu_ri(0, HOST_EAX, d.imm);
+    x.alu_ri(4, HOST_EAX, 8191);
+}
+
+/*
+    emit_instr(b, d, pc, count)
+    emits native code for one instruction
+    parameters:
+        b = block being compiled
+        d = predecoded instruction
+        pc = address of the instruction
+        count = number of instructions executed once this one is done
+ */
+inline void emit_instr(JitBuild &b, const DecodedInstr &d, uint16_t pc, uint32_t count) {
+    X86Emitter &x = b.x;
+    switch (d.op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_OR:
+        case OP_AND: {
+            static const uint8_t opcodes[] = {0x01, 0x29, 0x09, 0x21};
+            emit_read_guest(x, HOST_EAX, d.a);
+            emit_read_guest(x, HOST_ECX, d.b);
+            x.alu_rr(opcodes[d.op - OP_ADD], HOST_EAX, HOST_ECX);
+            emit_write_guest(x, d.dst);
+            break;
+        }
+        case OP_SLT:
+            emit_read_guest(x, HOST_EAX, d.a);
+            emit_read_guest(x, HOST_ECX, d.b);
+            x.alu_rr(0x39, HOST_EAX, HOST_ECX);
+            x.setb_eax();
+            emit_write_guest(x, d.dst);
+            break;
+        case OP_SLTI:
+            emit_read_guest(x, HOST_EAX, d.a);
+            x.alu_ri(7, HOST_EAX, d.imm);
+            x.setb_eax();
+            emit_write_guest(x, d.dst);
+            break;
+        case OP_ADDI:
+            emit_read_guest(x, HOST_EAX, d.a);
+            x.alu_ri(0, HOST_EAX, d.imm);
+            emit_write_guest(x, d.dst);
+            break;
+        case OP_LW:
+            emit_address(x, d);
+            // movzx eax, word [rsi + rax*2]
+            x.byte(0x0F); x.byte(0xB7); x.byte(0x04); x.byte(0x46);
+            emit_write_guest(x, d.dst);
+            break;
+        case OP_SW: {
+            emit_address(x, d);
+            emit_read_guest(x, HOST_ECX, d.b);
+            // mov word [rsi + rax*2], cx
+            x.byte(0x66); x.byte(0x89); x.byte(0x0C); x.byte(0x46);
+            // or byte [rdx + rax], JIT_DIRTY
+            x.byte(0x80); x.byte(0x0C); x.byte(0x02); x.byte(JIT_DIRTY);
+            // test byte [rdx + rax], JIT_WATCHED
+            x.byte(0xF6); x.byte(0x04); x.byte(0x02); x.byte(JIT_WATCHED);
+            size_t unwatched = x.jcc(0x84);
+            // hand back the instructions after the store, then return the store address
+            x.alu_r15_imm(0, b.length - count);
+            // shl eax, 16
+            x.byte(0xC1); x.byte(0xE0); x.byte(16);
+            x.alu_ri(1, HOST_EAX, JIT_EXIT_STORE | (uint16_t)(pc + 1));
+            b.to_exit.push_back(x.jmp());
+            x.patch_here(unwatched);
+            break;
+        }
+        case OP_JEQ: {
+            emit_read_guest(x, HOST_EAX, d.a);
+            emit_read_guest(x, HOST_ECX, d.b);
+            x.alu_rr(0x39, HOST_EAX, HOST_ECX);
+            size_t not_taken = x.jcc(0x85);
+            emit_exit_to(b, pc + d.imm + 1);
+            x.patch_here(not_taken);
+            emit_exit_to(b, pc + 1);
+            break;
+        }
+        case OP_J:
+            emit_exit_to(b, d.imm);
+            break;
+        case OP_JAL:
+            x.mov_ri(guest_reg(7), (uint16_t)(pc + 1));
+            emit_exit_to(b, d.imm);
+            break;
+        case OP_JR:
+            emit_read_guest(x, HOST_EAX, d.a);
+            b.to_exit.push_back(x.jmp());
+            break;
+        default: // OP_NOP
+            break;
+    }
+}
+
+/*
+    jit_link(e, link)
+    points a block exit at the compiled block for its target, or back at the return
+        to the engine if there is none (or linking is off)
+        the exit must be writable (see jit_protect)
+    parameters:
+        e = engine owning the code
+        link = exit to update
+ */
+inline void jit_link(JitEngine &e, const JitLink &link) {
+    uint8_t *dest = link.site + 4;
+    JitBlock *target = link.target < MEM_SIZE ? e.compiled[link.target] : nullptr;
+    if (e.linking && target != nullptr) {
+        dest = target->body;
+    }
+    uint32_t rel = dest - (link.site + 4);
+    memcpy(link.site, &rel, 4);
+}
+
+/*
+    flush_jit(e)
+    throws away every compiled block and all of the executable memory
+    parameters:
+        e = engine being flushed
+ */
+inline void flush_jit(JitEngine &e) {
+    for (size_t i = 0; i < MEM_SIZE; i++) {
+        e.compiled[i] = nullptr;
+        e.cover[i] = 0;
+        e.state[i] &= ~JIT_WATCHED;
+    }
+    e.blocks.clear();
+    for (size_t i = 0; i < MEM_SIZE; i++) {
+        e.links[i].clear();
+    }
+    e.code_used = 0;
+}
+
+/*
+    jit_invalidate(e, addr)
+    drops every compiled block that contains addr, after addr has been overwritten
+        exits linked to a dropped block go back to returning to the engine
+    parameters:
+        e = engine owning the blocks
+        addr = memory address that was written
+ */
+inline void jit_invalidate(JitEngine &e, int addr) {
+    int first = addr - (int)MAX_JIT_BLOCK_LEN + 1;
+    if (first < 0) {
+        first = 0;
+    }
+    // drop the blocks, then unlink the exits into them with the code writable just once
+    int dropped[MAX_JIT_BLOCK_LEN];
+    int num_dropped = 0;
+    uint8_t *from = nullptr;
+    uint8_t *to = nullptr;
+    for (int start = first; start <= addr; start++) {
+        JitBlock *b = e.compiled[start];
+        if (b != nullptr && b->end >= addr) {
+            e.compiled[start] = nullptr;
+            for (int i = b->start; i <= b->end; i++) {
+                e.cover[i]--;
+                if (e.cover[i] == 0) {
+                    e.state[i] &= ~JIT_WATCHED;
+                }
+            }
+            dropped[num_dropped++] = start;
+            jit_span(e.links[start], from, to);
+        }
+    }
+    if (from == nullptr) {
+        return;
+    }
+    jit_protect(from, to, true);
+    for (int i = 0; i < num_dropped; i++) {
+        for (const JitLink &link : e.links[dropped[i]]) {
+            jit_link(e, link);
+        }
+    }
+    jit_protect(from, to, false);
+}
+
+/*
+    jit_compile(e, start)
+    compiles the basic block starting at start
+        the block stops at the first jump, after MAX_JIT_BLOCK_LEN instructions,
+            at the end of memory, or just before a halt (halts are left to the interpreter)
+    returns the new block, or nullptr if there was nothing to compile
+    parameters:
+        e = engine to compile into
+        start = address of the first instruction, below MEM_SIZE
+ */
+inline JitBlock *jit_compile(JitEngine &e, uint16_t start) {
+    // find the extent of the block first; compiled code sees memory, not the possibly stale predecoded image
+    std::vector<DecodedInstr> instrs;
+    uint16_t addr = start;
+    bool jumps = false;
+    while (true) {
+        DecodedInstr d = decode(e.m.mem[addr]);
+        if (d.op == OP_J && d.imm == addr) {
+            break;
+        }
+        instrs.push_back(d);
+        if (d.op == OP_J || d.op == OP_JAL || d.op == OP_JR || d.op == OP_JEQ) {
+            jumps = true;
+            break;
+        }
+        if (instrs.size() == MAX_JIT_BLOCK_LEN || addr == MEM_SIZE - 1) {
+            break;
+        }
+        addr++;
+    }
+    if (instrs.empty()) {
+        return nullptr;
+    }
+    uint16_t end = start + instrs.size() - 1;
+
+    JitBuild b;
+    b.length = instrs.size();
+    X86Emitter &x = b.x;
+    // prologue: save the callee-saved registers we use, load the bases, the budget and the guests
+    x.push(12);
+    x.push(13);
+    x.push(14);
+    x.push(15);
+    x.mov_ri64(HOST_RDI, (uint64_t)(uintptr_t)e.m.regs);
+    x.mov_ri64(HOST_RSI, (uint64_t)(uintptr_t)e.m.mem);
+    x.mov_ri64(HOST_RDX, (uint64_t)(uintptr_t)e.state);
+    x.mov_ri64(HOST_ECX, (uint64_t)(uintptr_t)&e.budget);
+    // mov r15, [rcx]
+    x.byte(0x4C); x.byte(0x8B); x.byte(0x39);
+    for (int g = 1; g < (int)NUM_REGS; g++) {
+        x.load_rdi16(guest_reg(g), 2 * g);
+    }
+    // body: return to the engine if the whole block doesn't fit in the budget, otherwise take it out
+    size_t body = x.out.size();
+    x.alu_r15_imm(7, b.length);
+    size_t fits = x.jcc(0x83);
+    emit_return(b, start);
+    x.patch_here(fits);
+    x.alu_r15_imm(5, b.length);
+    for (uint32_t i = 0; i < b.length; i++) {
+        emit_instr(b, instrs[i], start + i, i + 1);
+    }
+    if (!jumps) {
+        emit_exit_to(b, end + 1);
+    }
+    // shared exit: write the guests and the budget back, restore the callee-saved registers
+    size_t exit = x.out.size();
+    for (int g = 1; g < (int)NUM_REGS; g++) {
+        x.store_rdi16(2 * g, guest_reg(g));
+    }
+    x.mov_ri64(HOST_ECX, (uint64_t)(uintptr_t)&e.budget);
+    // mov [rcx], r15
+    x.byte(0x4C); x.byte(0x89); x.byte(0x39);
+    x.pop(15);
+    x.pop(14);
+    x.pop(13);
+    x.pop(12);
+    x.byte(0xC3);
+    for (size_t site : b.to_exit) {
+        x.patch(site, exit);
+    }
+
+    if (e.code_used + x.out.size() > JIT_CODE_SIZE) {
+        flush_jit(e);
+    }
+    // the new code, and the earlier exits that were waiting for it
+    uint8_t *entry = e.code + e.code_used;
+    uint8_t *from = entry;
+    uint8_t *to = entry + x.out.size();
+    jit_span(e.links[start], from, to);
+    jit_protect(from, to, true);
+    memcpy(entry, x.out.data(), x.out.size());
+    e.code_used += x.out.size();
+
+    std::unique_ptr<JitBlock> blk(new JitBlock());
+    blk->start = start;
+    blk->end = end;
+    blk->fn = (JitFn)(void *)entry;
+    blk->body = entry + body;
+    blk->length = b.length;
+    for (int i = start; i <= end; i++) {
+        e.cover[i]++;
+        e.state[i] |= JIT_WATCHED;
+    }
+    JitBlock *p = blk.get();
+    e.blocks.push_back(std::move(blk));
+    e.compiled[start] = p;
+    // link the new block's exits, and every earlier exit that was waiting for it
+    for (const JitLink &link : e.links[start]) {
+        jit_link(e, link);
+    }
+    for (const std::pair<size_t, uint16_t> &l : b.links) {
+        JitLink link = {entry + l.first, l.second};
+        if (link.target < MEM_SIZE) {
+            e.links[link.target].push_back(link);
+            jit_link(e, link);
+        }
+    }
+    jit_protect(from, to, false);
+    return p;
+}
+
+/*
+    jit_sync_decoded(e)
+    re-decodes every cell compiled code has written since the last sync
+    parameters:
+        e = engine whose machine's predecoded image is brought up to date
+ */
+inline void jit_sync_decoded(JitEngine &e) {
+    for (size_t i = 0; i < MEM_SIZE; i++) {
+        if (e.state[i] & JIT_DIRTY) {
+            e.m.decoded[i] = decode(e.m.mem[i]);
+            e.state[i] &= ~JIT_DIRTY;
+        }
+    }
+}
+
+/*
+    jit_check(e, shadow, count, pc)
+    lockstep check: runs the interpreter on shadow for count instructions
+        and stops the program if it doesn't end up in the same state as e.m
+    parameters:
+        e = engine that just ran count instructions
+        shadow = copy of the machine run by the interpreter only
+        count = number of instructions the engine just ran
+        pc = pc the engine ran them from
+ */
+inline void jit_check(JitEngine &e, Machine &shadow, uint64_t count, uint16_t pc) {
+    for (uint64_t i = 0; i < count; i++) {
+        step(shadow);
+    }
+    Machine &m = e.m;
+    bool same = m.pc == shadow.pc && m.halted == shadow.halted &&
+        memcmp(m.regs, shadow.regs, sizeof(m.regs)) == 0 &&
+        memcmp(m.mem, shadow.mem, sizeof(m.mem)) == 0;
+    if (!same) {
+        std::cerr << "JIT check failed after running " << count << " instructions from pc " << pc << std::endl;
+        std::cerr << "\tjit:         pc=" << m.pc;
+        for (size_t r = 0; r < NUM_REGS; r++)
+            std::cerr << " $" << r << "=" << m.regs[r];
+        std::cerr << std::endl << "\tinterpreter: pc=" << shadow.pc;
+        for (size_t r = 0; r < NUM_REGS; r++)
+            std::cerr << " $" << r << "=" << shadow.regs[r];
+        std::cerr << std::endl;
+        exit(1);
+    }
+}
+
+/*
+    run_jit(e, n, shadow)
+    executes up to n instructions of e.m, stopping early if the program halts
+        cold code is interpreted; hot blocks are compiled and run natively
+        leaves the machine in exactly the state the same number of step calls would
+    returns the number of instructions executed (the halt included)
+    parameters:
+        e = engine wrapping the machine to run
+        n = instruction limit, RUN_UNTIL_HALT for none
+        shadow = if not nullptr, a copy of e.m that is run on the interpreter in lockstep
+            and compared every time compiled code returns (see jit_check)
+ */
+inline uint64_t run_jit(JitEngine &e, uint64_t n, Machine *shadow = nullptr) {
+    Machine &m = e.m;
+    uint64_t count = 0;
+    while (!m.halted && count < n) {
+        uint16_t pc = m.pc;
+        if (jit_available(e) && pc < MEM_SIZE) {
+            JitBlock *b = e.compiled[pc];
+            if (b == nullptr && ++e.heat[pc] >= e.threshold) {
+                e.heat[pc] = 0;
+                b = jit_compile(e, pc);
+            }
+            if (b != nullptr && n - count >= b->length) {
+                e.budget = n - count;
+                uint32_t ret = b->fn();
+                uint64_t executed = (n - count) - e.budget;
+                count += executed;
+                m.pc = ret & 0xFFFF;
+                if (ret & JIT_EXIT_STORE) {
+                    jit_invalidate(e, (ret >> 16) & 8191);
+                }
+                if (shadow != nullptr) {
+                    jit_check(e, *shadow, executed, pc);
+                }
+                continue;
+            }
+        }
+        // interpret one instruction
+        int cell = pc & 8191;
+        if (e.state[cell] & JIT_DIRTY) {
+            m.decoded[cell] = decode(m.mem[cell]);
+            e.state[cell] &= ~JIT_DIRTY;
+        }
+        const DecodedInstr &d = m.decoded[cell];
+        int store_addr = -1;
+        if (d.op == OP_SW) {
+            store_addr = (m.regs[d.a] + d.imm) & 8191;
+        }
+        step(m);
+        count++;
+        if (store_addr >= 0 && (e.state[store_addr] & JIT_WATCHED)) {
+            jit_invalidate(e, store_addr);
+        }
+        if (shadow != nullptr) {
+            step(*shadow);
+        }
+    }
+    jit_sync_decoded(e);
+    return count;
+}
+
+#endif // E20_JIT_H
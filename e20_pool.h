@@ -0,0 +1,123 @@
+/*
+E20 simulator work pool
+e20_pool.h
+
+Runs a fixed set of independent jobs, numbered 0 to count - 1, on a
+group of threads. Each thread starts with its own contiguous share of
+the jobs and works through it from the back; a thread that runs out
+steals from the front of another thread's share. Jobs that take much
+longer than the rest (long running programs) therefore don't leave the
+other threads idle.
+*/
+
+#ifndef E20_POOL_H
+#define E20_POOL_H
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    WorkQueue
+    jobs not yet started by one thread of the pool
+        lock = guards items; taken by the owner and by any thread stealing from it
+        items = job numbers
+ */
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<size_t> items;
+};
+
+/*
+    pool_take(queues, self, job)
+    takes the next job for thread self: from the back of its own queue,
+        or else from the front of the first other queue that still has one
+    returns false once every queue is empty
+    parameters:
+        queues = one queue per thread
+        self = number of the calling thread
+        job = receives the job number
+ */
+inline bool pool_take(std::vector<std::unique_ptr<WorkQueue>> &queues, size_t self, size_t &job) {
+    {
+        WorkQueue &own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.items.empty()) {
+            job = own.items.back();
+            own.items.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        WorkQueue &victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.items.empty()) {
+            job = victim.items.front();
+            victim.items.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    pool_threads(requested)
+    returns the number of threads to use: requested if it isn't 0,
+        otherwise one per hardware thread
+ */
+inline size_t pool_threads(size_t requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+/*
+    run_pool(count, threads, task)
+    calls task(job, thread) once for every job number below count, spread over threads threads,
+        and returns once all of them are done
+        task must be safe to call from several threads at once; thread (below threads)
+            tells it which per-thread scratch state it may use
+    parameters:
+        count = number of jobs
+        threads = number of threads to use (see pool_threads)
+        task = callable run for every job
+ */
+template <typename Task>
+inline void run_pool(size_t count, size_t threads, Task task) {
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads <= 1) {
+        for (size_t job = 0; job < count; job++) {
+            task(job, 0);
+        }
+        return;
+    }
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    for (size_t t = 0; t < threads; t++) {
+        queues.emplace_back(new WorkQueue());
+        // contiguous shares, worked through from the back
+        for (size_t job = count * t / threads; job < count * (t + 1) / threads; job++) {
+            queues[t]->items.push_back(job);
+        }
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&queues, &task, t]() {
+            size_t job;
+            while (pool_take(queues, t, job)) {
+                task(job, t);
+            }
+        });
+    }
+    for (std::thread &w : workers) {
+        w.join();
+    }
+}
+
+#endif // E20_POOL_H
@@ -0,0 +1,127 @@
+/*
+E20 simulator execution statistics
+e20_stats.h
+
+An observer (see NoObserver in e20.h) that counts what a program does:
+how often each instruction is executed, how often each address is
+executed, and how often jeq branches. Running with a plain NoObserver
+instead compiles all of the counting away.
+*/
+
+#ifndef E20_STATS_H
+#define E20_STATS_H
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include "e20.h"
+
+// instructions told apart by ExecStats, in the order they are printed
+enum InstrKind : uint8_t {
+    KIND_ADD, KIND_SUB, KIND_OR, KIND_AND, KIND_SLT, KIND_JR,
+    KIND_ADDI, KIND_LW, KIND_SW, KIND_JEQ, KIND_J, KIND_JAL, KIND_SLTI,
+    KIND_INVALID, NUM_INSTR_KINDS
+};
+
+const char *const INSTR_KIND_NAMES[NUM_INSTR_KINDS] = {
+    "add", "sub", "or", "and", "slt", "jr",
+    "addi", "lw", "sw", "jeq", "j", "jal", "slti",
+    "invalid"
+};
+
+/*
+    instr_kind(instr)
+    returns which instruction a machine code word is
+        unlike decode, an instruction writing $0 still counts as what it is
+    parameters:
+        instr = 16 bit machine code instruction
+ */
+inline InstrKind instr_kind(uint16_t instr) {
+    // kinds of the 3 register instructions by func (4 lsb)
+    static const InstrKind three_reg[16] = {
+        KIND_ADD, KIND_SUB, KIND_OR, KIND_AND, KIND_SLT, KIND_INVALID, KIND_INVALID, KIND_INVALID,
+        KIND_JR, KIND_INVALID, KIND_INVALID, KIND_INVALID, KIND_INVALID, KIND_INVALID, KIND_INVALID, KIND_INVALID
+    };
+    // kinds of everything else by the 3 msb
+    static const InstrKind by_opcode[8] = {
+        KIND_INVALID, KIND_ADDI, KIND_J, KIND_JAL, KIND_LW, KIND_SW, KIND_JEQ, KIND_SLTI
+    };
+    int three_msb = instr >> 13;
+    if (three_msb == 0) {
+        return three_reg[instr & 15];
+    }
+    return by_opcode[three_msb];
+}
+
+/*
+    ExecStats
+    observer counting every instruction executed
+        kind_count[] = times each kind of instruction was executed (see InstrKind);
+            "invalid" counts unassigned 3 register func codes, which execute as no-ops
+        pc_count[] = times the instruction at each address was executed
+        jeq_taken, jeq_not_taken = how often a jeq branched, and how often it fell through
+ */
+struct ExecStats : NoObserver {
+    static const bool sees_every_instruction = true;
+    uint64_t kind_count[NUM_INSTR_KINDS];
+    uint64_t pc_count[MEM_SIZE];
+    uint64_t jeq_taken;
+    uint64_t jeq_not_taken;
+
+    ExecStats() : jeq_taken(0), jeq_not_taken(0) {
+        memset(kind_count, 0, sizeof(kind_count));
+        memset(pc_count, 0, sizeof(pc_count));
+    }
+
+    void on_instr(uint16_t pc, uint16_t instr) {
+        kind_count[instr_kind(instr)]++;
+        pc_count[pc & 8191]++;
+    }
+
+    void on_jeq(uint16_t, bool taken) {
+        if (taken) {
+            jeq_taken++;
+        }
+        else {
+            jeq_not_taken++;
+        }
+    }
+};
+
+/*
+    print_stats(out, stats)
+    prints the counts in stats: one line per kind of instruction executed,
+        the jeq taken ratio, and one line per address executed, in address order
+    parameters:
+        out = stream to print to
+        stats = counts to print
+ */
+inline void print_stats(std::ostream &out, const ExecStats &stats) {
+    uint64_t total = 0;
+    for (size_t k = 0; k < NUM_INSTR_KINDS; k++) {
+        total += stats.kind_count[k];
+    }
+    out << std::setfill(' ') << std::dec;
+    out << "Instructions executed: " << total << std::endl;
+    for (size_t k = 0; k < NUM_INSTR_KINDS; k++) {
+        if (stats.kind_count[k] > 0) {
+            out << "\t" << std::left << std::setw(8) << INSTR_KIND_NAMES[k] << std::right <<
+                std::setw(12) << stats.kind_count[k] << std::endl;
+        }
+    }
+    uint64_t jeqs = stats.jeq_taken + stats.jeq_not_taken;
+    out << "jeq taken: " << stats.jeq_taken << " of " << jeqs;
+    if (jeqs > 0) {
+        out << " (" << std::fixed << std::setprecision(1) << 100.0 * stats.jeq_taken / jeqs << "%)";
+    }
+    out << std::endl;
+    out << "Executions per address:" << std::endl;
+    for (size_t addr = 0; addr < MEM_SIZE; addr++) {
+        if (stats.pc_count[addr] > 0) {
+            out << "\t" << std::setw(5) << addr << std::setw(12) << stats.pc_count[addr] << std::endl;
+        }
+    }
+}
+
+#endif // E20_STATS_H
@@ -0,0 +1,548 @@
+/*
+E20 simulator execution traces
+e20_trace.h
+
+Observers (see NoObserver in e20.h) that record what a program does:
+
+    TextTrace       a line for every instruction executed, with the
+                    address and outcome of every lw, sw and jeq under it
+    BinaryTrace     a compact .e20t file of every pc executed and the
+                    address and value of every lw and sw, written by a
+                    background thread; TraceReader reads it back
+
+An .e20t file is a 16 byte header (magic "E20TRACE", version, 4 bytes
+reserved) followed by blocks. Each block starts with its size in bytes
+and the number of instructions in it (32 bits each, little-endian), and
+holds a sequence of records, each a tag byte whose 2 lsb give its kind:
+
+    TRACE_TAG_RUN   n instructions, each at the address after the last
+    TRACE_TAG_JUMP  one instruction, at d past the address after the last
+    TRACE_TAG_LW    a lw or sw by the last instruction, at d past the last
+    TRACE_TAG_SW        address loaded or stored, then the word as a varint
+
+The 6 msb of the tag hold n - 1, or d zigzag encoded, when that is below
+63; otherwise they are all ones and the rest follows as a varint (7 bits
+per byte, lsb first). Every block starts afresh from "last" pc 0xFFFF
+and "last" address 0, so each can be decoded on its own.
+
+Blocks are left uncompressed on purpose: the encoding above already
+takes under a byte per instruction, and costs the run next to nothing,
+with no library beyond the standard one. Where disk matters more, gzip
+or xz over the finished file shrinks it another 3 to 6 times (for
+tests/long_loop.s). tests/trace_roundtrip.cpp checks that a trace of
+several blocks reads back exactly as it was recorded.
+*/
+
+#ifndef E20_TRACE_H
+#define E20_TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "e20.h"
+#include "e20_stats.h"
+
+/*
+    TextTrace
+    observer writing a human readable trace of execution, e.g.
+            3 8d01 lw
+                    lw addr:   27
+        out = stream the trace goes to
+ */
+struct TextTrace : NoObserver {
+    static const bool sees_every_instruction = true;
+    std::ostream &out;
+
+    explicit TextTrace(std::ostream &stream) : out(stream) {
+        out << std::setfill(' ');
+    }
+
+    void on_instr(uint16_t pc, uint16_t instr) {
+        out << std::dec << std::setw(5) << pc << " " << std::hex << std::setfill('0') << std::setw(4) << instr <<
+            std::setfill(' ') << " " << INSTR_KIND_NAMES[instr_kind(instr)] << '\n';
+    }
+
+    void on_lw(uint16_t, int addr, uint16_t) {
+        out << "\tlw addr:" << std::dec << std::setw(5) << addr << '\n';
+    }
+
+    void on_sw(uint16_t, int addr, uint16_t) {
+        out << "\tsw addr:" << std::dec << std::setw(5) << addr << '\n';
+    }
+
+    void on_jeq(uint16_t, bool taken) {
+        out << (taken ? "\ttaken\n" : "\tnot taken\n");
+    }
+};
+
+char const static TRACE_MAGIC[8] = {'E', '2', '0', 'T', 'R', 'A', 'C', 'E'};
+uint32_t const static TRACE_VERSION = 1;
+size_t const static TRACE_HEADER_SIZE = 16;
+size_t const static TRACE_BLOCK_HEADER_SIZE = 8;
+// bytes of records gathered before a block is handed to the writer thread
+size_t const static TRACE_BLOCK_SIZE = 1 << 16;
+// blocks that may wait for the writer thread before the simulation waits for it too
+size_t const static TRACE_QUEUE_DEPTH = 8;
+
+enum TraceTag : uint8_t {
+    TRACE_TAG_RUN, TRACE_TAG_JUMP, TRACE_TAG_LW, TRACE_TAG_SW
+};
+
+// largest count or delta kept in the tag byte itself
+uint32_t const static TRACE_TAG_INLINE = 63;
+
+inline void trace_put_varint(std::vector<uint8_t> &out, uint32_t v) {
+    while (v >= 128) {
+        out.push_back((v & 127) | 128);
+        v >>= 7;
+    }
+    out.push_back(v);
+}
+
+inline void trace_put_tagged(std::vector<uint8_t> &out, TraceTag tag, uint32_t v) {
+    if (v < TRACE_TAG_INLINE) {
+        out.push_back(tag | (v << 2));
+    }
+    else {
+        out.push_back(tag | (TRACE_TAG_INLINE << 2));
+        trace_put_varint(out, v - TRACE_TAG_INLINE);
+    }
+}
+
+// maps small negative and positive deltas to small numbers: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+inline uint32_t trace_zigzag(int32_t d) {
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+inline int32_t trace_unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+inline void trace_put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+inline uint32_t trace_get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+    TraceWriter
+    writes the blocks of a trace file on a thread of its own
+        the simulation hands over full blocks with submit, and only waits
+            when TRACE_QUEUE_DEPTH blocks are already waiting to be written
+        out = the trace file
+        lock = guards everything below it
+        changed = signalled whenever full, spare or closing change
+        full = blocks waiting to be written, oldest first
+        spare = written blocks, kept so their buffers can be reused
+        closing = set once no more blocks will come
+        failed = set if a write failed
+ */
+struct TraceWriter {
+    std::ofstream out;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> full;
+    std::vector<std::vector<uint8_t>> spare;
+    bool closing;
+    bool failed;
+    std::thread thread;
+
+    TraceWriter() : closing(false), failed(false) {}
+
+    ~TraceWriter() {
+        std::string error;
+        close(error);
+    }
+
+    /*
+        open(name, error)
+        creates the trace file name, writes its header and starts the writer thread
+        returns false, with a description in error, if the file can't be created
+     */
+    bool open(const std::string &name, std::string &error) {
+        out.open(name, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            error = "Can't open file " + name;
+            return false;
+        }
+        uint8_t header[TRACE_HEADER_SIZE] = {0};
+        memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        trace_put32(header + 8, TRACE_VERSION);
+        out.write((const char *)header, sizeof(header));
+        thread = std::thread([this]() { work(); });
+        return true;
+    }
+
+    /*
+        submit(block)
+        queues block to be written, leaving an empty buffer in its place
+     */
+    void submit(std::vector<uint8_t> &block) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]() { return full.size() < TRACE_QUEUE_DEPTH; });
+        full.push_back(std::move(block));
+        if (!spare.empty()) {
+            block = std::move(spare.back());
+            spare.pop_back();
+        }
+        else {
+            block = std::vector<uint8_t>();
+        }
+        block.clear();
+        changed.notify_all();
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            changed.wait(guard, [this]() { return !full.empty() || closing; });
+            if (full.empty()) {
+                return;
+            }
+            std::vector<uint8_t> block = std::move(full.front());
+            full.pop_front();
+            guard.unlock();
+            out.write((const char *)block.data(), block.size());
+            guard.lock();
+            failed = failed || !out;
+            spare.push_back(std::move(block));
+            changed.notify_all();
+        }
+    }
+
+    /*
+        close(error)
+        writes out the blocks still queued, stops the writer thread and closes the file
+        returns false, with a description in error, if any write failed
+     */
+    bool close(std::string &error) {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                closing = true;
+                changed.notify_all();
+            }
+            thread.join();
+            out.close();
+            failed = failed || !out;
+        }
+        if (failed) {
+            error = "Can't write trace";
+            return false;
+        }
+        return true;
+    }
+};
+
+/*
+    BinaryTrace
+    observer recording every instruction executed, and the address and value
+        of every lw and sw, to an .e20t file (see the top of this file)
+        open the file with open, and call finish once the run is over
+        writer = writes full blocks in the background
+        block = block being filled, starting with room for its header
+        last_pc = address of the last instruction seen
+        last_addr = address of the last lw or sw seen
+        run = instructions seen after the last record, each at the address after the one before
+        block_instrs = instructions in block
+ */
+struct BinaryTrace : NoObserver {
+    static const bool sees_every_instruction = true;
+    TraceWriter writer;
+    std::vector<uint8_t> block;
+    uint16_t last_pc;
+    int last_addr;
+    uint32_t run;
+    uint32_t block_instrs;
+
+    BinaryTrace() {
+        start_block();
+    }
+
+    bool open(const std::string &name, std::string &error) {
+        return writer.open(name, error);
+    }
+
+    void start_block() {
+        block.reserve(TRACE_BLOCK_SIZE + 64);
+        block.resize(TRACE_BLOCK_HEADER_SIZE);
+        last_pc = 0xFFFF;
+        last_addr = 0;
+        run = 0;
+        block_instrs = 0;
+    }
+
+    void end_run() {
+        if (run > 0) {
+            trace_put_tagged(block, TRACE_TAG_RUN, run - 1);
+            run = 0;
+        }
+    }
+
+    void end_block() {
+        end_run();
+        trace_put32(block.data(), block.size() - TRACE_BLOCK_HEADER_SIZE);
+        trace_put32(block.data() + 4, block_instrs);
+        writer.submit(block);
+        start_block();
+    }
+
+    void on_instr(uint16_t pc, uint16_t) {
+        // blocks end between instructions, so a lw or sw is always in the block of its instruction
+        if (block.size() >= TRACE_BLOCK_SIZE) {
+            end_block();
+        }
+        block_instrs++;
+        if (pc == (uint16_t)(last_pc + 1)) {
+            run++;
+        }
+        else {
+            end_run();
+            trace_put_tagged(block, TRACE_TAG_JUMP, trace_zigzag((int16_t)(pc - (uint16_t)(last_pc + 1))));
+        }
+        last_pc = pc;
+    }
+
+    void on_lw(uint16_t, int addr, uint16_t value) {
+        end_run();
+        trace_put_tagged(block, TRACE_TAG_LW, trace_zigzag(addr - last_addr));
+        trace_put_varint(block, value);
+        last_addr = addr;
+    }
+
+    void on_sw(uint16_t, int addr, uint16_t value) {
+        end_run();
+        trace_put_tagged(block, TRACE_TAG_SW, trace_zigzag(addr - last_addr));
+        trace_put_varint(block, value);
+        last_addr = addr;
+    }
+
+    /*
+        finish(error)
+        writes out everything recorded and closes the file
+        returns false, with a description in error, if the trace couldn't be written
+     */
+    bool finish(std::string &error) {
+        if (block_instrs > 0) {
+            end_block();
+        }
+        return writer.close(error);
+    }
+};
+
+// what a TraceRecord describes
+enum TraceKind : uint8_t {
+    TRACE_INSTR, TRACE_LW, TRACE_SW
+};
+
+/*
+    TraceRecord
+    one event read back from an .e20t file
+        kind = an instruction executed, or a lw or sw done by the last instruction
+        pc = address of the instruction
+        addr, value = address and word loaded or stored (0 for TRACE_INSTR)
+ */
+struct TraceRecord {
+    TraceKind kind;
+    uint16_t pc;
+    uint16_t addr;
+    uint16_t value;
+};
+
+/*
+    TraceReader
+    reads an .e20t file back one record at a time, a block in memory at a time, e.g.
+            TraceReader reader;
+            TraceRecord r;
+            if (!reader.open(name, error)) ...
+            while (reader.next(r)) ...
+            if (reader.error.size() > 0) ...
+        error = description of what was wrong with the file, once next has returned false
+ */
+struct TraceReader {
+    std::ifstream in;
+    std::vector<uint8_t> block;
+    size_t pos;
+    uint32_t block_instrs;
+    uint32_t seen_instrs;
+    uint32_t run_left;
+    uint16_t last_pc;
+    int last_addr;
+    std::string error;
+
+    TraceReader() : pos(0), block_instrs(0), seen_instrs(0), run_left(0), last_pc(0xFFFF), last_addr(0) {}
+
+    /*
+        open(name, error)
+        opens the trace file name and checks its header
+        returns false, with a description in error, if it isn't a readable trace
+     */
+    bool open(const std::string &name, std::string &error) {
+        in.open(name, std::ios::binary);
+        if (!in.is_open()) {
+            error = "Can't open file " + name;
+            return false;
+        }
+        uint8_t header[TRACE_HEADER_SIZE];
+        if (!in.read((char *)header, sizeof(header)) || memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+            error = "Not a trace file: " + name;
+            return false;
+        }
+        if (trace_get32(header + 8) != TRACE_VERSION) {
+            error = "Unsupported trace version " + std::to_string(trace_get32(header + 8));
+            return false;
+        }
+        return true;
+    }
+
+    bool corrupt() {
+        error = "Trace is corrupt or truncated";
+        return false;
+    }
+
+    bool get_varint(uint32_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos >= block.size()) {
+                return false;
+            }
+            uint8_t byte = block[pos++];
+            v |= (uint32_t)(byte & 127) << shift;
+            if (byte < 128) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool get_tagged(uint8_t tag, uint32_t &v) {
+        v = tag >> 2;
+        if (v < TRACE_TAG_INLINE) {
+            return true;
+        }
+        if (!get_varint(v)) {
+            return false;
+        }
+        v += TRACE_TAG_INLINE;
+        return true;
+    }
+
+    // reads the next block; false at the end of the file (or on error)
+    bool next_block() {
+        if (seen_instrs != block_instrs) {
+            return corrupt();
+        }
+        uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+        if (!in.read((char *)header, sizeof(header))) {
+            if (in.gcount() != 0) {
+                return corrupt();
+            }
+            return false;
+        }
+        // the writer never lets a block grow much past TRACE_BLOCK_SIZE
+        if (trace_get32(header) > 2 * TRACE_BLOCK_SIZE) {
+            return corrupt();
+        }
+        block.resize(trace_get32(header));
+        block_instrs = trace_get32(header + 4);
+        if (!in.read((char *)block.data(), block.size())) {
+            return corrupt();
+        }
+        pos = 0;
+        seen_instrs = 0;
+        last_pc = 0xFFFF;
+        last_addr = 0;
+        return true;
+    }
+
+    /*
+        next(r)
+        reads the next record into r
+        returns false at the end of the trace, or if the trace is malformed (see error)
+     */
+    bool next(TraceRecord &r) {
+        if (run_left > 0) {
+            run_left--;
+        }
+        else {
+            while (pos >= block.size()) {
+                if (!next_block()) {
+                    return false;
+                }
+            }
+            uint8_t tag = block[pos++];
+            uint32_t v;
+            if (!get_tagged(tag, v)) {
+                return corrupt();
+            }
+            switch (tag & 3) {
+                case TRACE_TAG_RUN:
+                    run_left = v;
+                    break;
+                case TRACE_TAG_JUMP:
+                    last_pc += trace_unzigzag(v);
+                    break;
+                default: {
+                    uint32_t value;
+                    if (seen_instrs == 0 || !get_varint(value)) {
+                        return corrupt();
+                    }
+                    last_addr = (last_addr + trace_unzigzag(v)) & 8191;
+                    r.kind = (tag & 3) == TRACE_TAG_LW ? TRACE_LW : TRACE_SW;
+                    r.pc = last_pc;
+                    r.addr = last_addr;
+                    r.value = value;
+                    return true;
+                }
+            }
+        }
+        seen_instrs++;
+        last_pc++;
+        r.kind = TRACE_INSTR;
+        r.pc = last_pc;
+        r.addr = 0;
+        r.value = 0;
+        return true;
+    }
+};
+
+/*
+    replay_trace(reader, obs)
+    feeds the rest of a trace to an observer, as if the program were running again
+        obs.on_instr gets 0 for the machine code, which a trace doesn't record,
+            and obs.on_jeq isn't called
+    returns false if the trace is malformed (see reader.error)
+    parameters:
+        reader = open trace
+        obs = observer told about every instruction, lw and sw (see NoObserver)
+ */
+template <typename Observer>
+inline bool replay_trace(TraceReader &reader, Observer &obs) {
+    TraceRecord r;
+    while (reader.next(r)) {
+        if (r.kind == TRACE_INSTR) {
+            obs.on_instr(r.pc, 0);
+        }
+        else if (r.kind == TRACE_LW) {
+            obs.on_lw(r.pc, r.addr, r.value);
+        }
+        else {
+            obs.on_sw(r.pc, r.addr, r.value);
+        }
+    }
+    return reader.error.size() == 0;
+}
+
+#endif // E20_TRACE_H
@@ -8,349 +8,199 @@ sim.cpp
 #include <cstddef>
 #include <iostream>
 #include <string>
-#include <vector>
 #include <fstream>
-#include <iomanip>
-#include <regex>
-#include <cstdlib>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include "e20.h"
+#include "e20_block.h"
+#include "e20_jit.h"
+#include "e20_ensemble.h"
+#include "e20_pool.h"
+#include "e20_checkpoint.h"
+#include "e20_image.h"
+#include "e20_engine.h"
 
 using namespace std;
 
-// Some helpful constant values that we'll be using.
-size_t const static NUM_REGS = 8;
-size_t const static MEM_SIZE = 1<<13;
-
-
 /*
-    Loads an E20 machine code file into the list
-    provided by mem. We assume that mem is
-    large enough to hold the values in the machine
-    code file.
-
-    @param f Open file to read from
-    @param mem Array represetnting memory into which to read program
-*/
-void load_machine_code(ifstream &f, uint16_t mem[]) {
-    regex machine_code_re("^ram\\[(\\d+)\\] = 16'b(\\d+);.*$");
-    size_t expectedaddr = 0;
+    run_ensemble(images, program)
+    runs program from every memory image listed in the file images, all in lockstep,
+        and prints the final state of each one
+    returns the exit status for main
+    parameters:
+        images = name of a file listing one machine code file per line
+        program = machine with the program loaded; each image is loaded on top of it
+ */
+int run_ensemble(const char *images, const Machine &program) {
+    ifstream list(images);
+    if (!list.is_open()) {
+        cerr << "Can't open file "<<images<<endl;
+        return 1;
+    }
+    vector<string> names;
     string line;
-    while (getline(f, line)) {
-        smatch sm;
-        if (!regex_match(line, sm, machine_code_re)) {
-            cerr << "Can't parse line: " << line << endl;
-            exit(1);
-        }
-        size_t addr = stoi(sm[1], nullptr, 10);
-        unsigned instr = stoi(sm[2], nullptr, 2);
-        if (addr != expectedaddr) {
-            cerr << "Memory addresses encountered out of sequence: " << addr << endl;
-            exit(1);
-        }
-        if (addr >= MEM_SIZE) {
-            cerr << "Program too big for memory" << endl;
-            exit(1);
-        }
-        expectedaddr ++;
-        mem[addr] = instr;
+    while (getline(list, line)) {
+        if (line.size() > 0)
+            names.push_back(line);
     }
-}
-
-/*
-    Prints the current state of the simulator, including
-    the current program counter, the current register values,
-    and the first memquantity elements of memory.
-
-    @param pc The final value of the program counter
-    @param regs Final value of all registers
-    @param memory Final value of memory
-    @param memquantity How many words of memory to dump
-*/
-void print_state(uint16_t pc, uint16_t regs[], uint16_t memory[], size_t memquantity) {
-    cout << setfill(' ');
-    cout << "Final state:" << endl;
-    cout << "\tpc=" <<setw(5)<< pc << endl;
-
-    for (size_t reg=0; reg<NUM_REGS; reg++)
-        cout << "\t$" << reg << "="<<setw(5)<<regs[reg]<<endl;
-
-    cout << setfill('0');
-    bool cr = false;
-    for (size_t count=0; count<memquantity; count++) {
-        cout << hex << setw(4) << memory[count] << " ";
-        cr = true;
-        if (count % 8 == 7) {
-            cout << endl;
-            cr = false;
+    unique_ptr<Ensemble> e(new Ensemble(names.size()));
+    unique_ptr<Machine> m(new Machine(program));
+    for (size_t lane = 0; lane < names.size(); lane++) {
+        *m = program;
+        string error;
+        if (!load_program(names[lane], *m, error)) {
+            cerr << error << endl;
+            return 1;
         }
+        ensemble_load(*e, lane, *m);
     }
-    if (cr)
-        cout << endl;
-}
-
-/*
-    ALU(regs[], val1, val2, dst, op)
-    performs an ALU operation (which operation depends on op) on val1 and val2
-        stores the result in regs[dst]
-    parameters:
-        regs[] = an array containing the values of regs 1-7, passed by reference
-        val1 = first operand to the ALU
-        val2 = second operand to the ALU
-        op = opcode determining which ALU operation should be performed
- */
-void ALU(uint16_t regs[], int val1, int val2, int dst, const string& op) {
-    if ((op == "add") | (op == "addi")) {
-        int sum = val1 + val2;
-        regs[dst] = sum;
-    }
-    else if (op == "sub") {
-        int diff = val1 - val2;
-        regs[dst] = diff;
+    ensemble_run(*e, RUN_UNTIL_HALT);
+    for (size_t lane = 0; lane < names.size(); lane++) {
+        ensemble_store(*e, lane, *m);
+        cout << "Instance " << lane << ": " << names[lane] << endl;
+        print_state(m->pc, m->regs, m->mem, 128);
     }
+    return 0;
 }
 
 /*
-    less_than(regs[], val1, val2, dst)
-    checks if val1 is less than val2
-        if it is, stores 1 in regs[dst]- otherwise, stores 0
-    parameters:
-        regs[] = an array containing the values of regs 1-7
-        val1 = first operand of less-than operation
-        val2 = second operand to less-than operation
-        dst = register to store 0 or 1 in, depending on outcome of less-than operation
+    BatchJob
+    one line of a batch manifest
+        code = machine code file to run
+        init = machine code file loaded on top of code before running, empty for none
+        limit = instruction limit, RUN_UNTIL_HALT for none
+        output = final state (or error) of the job, in print_state format
+        failed = set if code or init couldn't be loaded
  */
-void less_than(uint16_t regs[], uint16_t val1, uint16_t val2, int dst) {
-    if (val1 < val2) {
-        regs[dst] = 1;
-    }
-    else {
-        regs[dst] = 0;
-    }
-}
+struct BatchJob {
+    string code;
+    string init;
+    uint64_t limit;
+    string output;
+    bool failed;
+};
 
 /*
-    sign_extend(imm, msb)
-    checks if the msb of imm is 0 or 1
-        if its 1, it sign extends imm so its 16 bits
+    read_manifest(manifest, jobs)
+    reads a batch manifest: one job per line, "code [init] [limit]"
+        blank lines and lines starting with # are skipped
+    returns false, after printing the reason, if the manifest can't be read
     parameters:
-        imm = immediate value
-        msb = number indicating which bit is the most significant bit of imm
+        manifest = name of the manifest file
+        jobs = receives the jobs in manifest order
  */
-uint16_t sign_extend(uint16_t imm, int msb) {
-    uint16_t check = 1 << (msb - 1);
-    if ((imm & check) == check) {
-        // sign extend by 1
-        if (msb == 7) {
-            // 65408 = 1111111110000000
-            imm = (imm | 65408);
+bool read_manifest(const char *manifest, vector<BatchJob> &jobs) {
+    ifstream f(manifest);
+    if (!f.is_open()) {
+        cerr << "Can't open file "<<manifest<<endl;
+        return false;
+    }
+    string line;
+    while (getline(f, line)) {
+        istringstream fields(line);
+        vector<string> parts;
+        string part;
+        while (fields >> part)
+            parts.push_back(part);
+        if (parts.size() == 0 || parts[0][0] == '#')
+            continue;
+        BatchJob job = {parts[0], "", RUN_UNTIL_HALT, "", false};
+        bool bad = parts.size() > 3;
+        for (size_t i = 1; i < parts.size() && !bad; i++) {
+            // a field made of digits is the limit, anything else the memory image
+            bool digits = parts[i].find_first_not_of("0123456789") == string::npos;
+            if (digits && parts[i].size() > 19)
+                bad = true;
+            else if (digits && job.limit == RUN_UNTIL_HALT)
+                job.limit = stoull(parts[i]);
+            else if (i == 1)
+                job.init = parts[i];
+            else
+                bad = true;
         }
-        else { // msb == 13
-            // 57344 = 1110000000000000
-            imm = imm | 57344;
+        if (bad) {
+            cerr << "Can't parse manifest line: " << line << endl;
+            return false;
         }
+        jobs.push_back(job);
     }
-    return imm;
+    return true;
 }
 
 /*
-    find_twos_complement(imm, msb)
-    checks if most significant bit of imm is 0 or 1
-        if its 1, it finds the twos complement of imm
-            sign extends imm
-            flips imms bits
-            adds 1 to imm
-        then multiplies imm by negative 1 to finish the process
+    run_batch_job(job, m)
+    loads and runs one batch job, leaving its final state in job.output
     parameters:
-        imm = immediate value
-        msb = number indicating which bit is the most significant bit of imm
+        job = job to run
+        m = scratch machine owned by the calling thread
  */
-int find_twos_complement(int imm, int msb) {
-    // pass in integer
-    // sign extend
-    // if MSB == 1
-    uint16_t check = 1 << (msb - 1);
-    // check if imm is negative
-    if ((imm & check) == check) {
-        // sign extend imm
-        imm = sign_extend(imm, msb);
-        // flip its bits
-        imm = imm ^ 65535;
-        // add 1
-        imm = imm + 1;
-        imm = imm * -1;
+void run_batch_job(BatchJob &job, Machine &m) {
+    ostringstream out;
+    init_machine(m);
+    string error;
+    const string *files[] = {&job.code, &job.init};
+    for (const string *file : files) {
+        if (file->size() == 0)
+            continue;
+        if (!load_program(*file, m, error)) {
+            job.output = "Error: " + error + "\n";
+            job.failed = true;
+            return;
+        }
     }
-    return imm;
+    uint64_t count = run(m, job.limit);
+    if (!m.halted && count == job.limit)
+        out << "Stopped after " << count << " instructions" << endl;
+    print_state(out, m.pc, m.regs, m.mem, 128);
+    job.output = out.str();
 }
 
 /*
-    execute(mem, pc, regs)
-    gets the current instruction to execute mem[pc]
-        based on the opcode of the current instruction, executes the current sequence of operations
+    run_batch(manifest, output_dir, threads)
+    runs every job of a batch manifest on a pool of threads
+        the final state of job k goes to output_dir/job<k>.out, or if output_dir is nullptr,
+        to standard output, in manifest order and each under a "Job k: ..." header
+    returns the exit status for main: 1 if the manifest or any job couldn't be loaded
     parameters:
-        mem[] = array containing the memory cells 0-8191
-        pc = program counter, tracks which mem cell should currently execute
-        regs[] = array containing the values of regs 1-7
+        manifest = name of the manifest file
+        output_dir = directory for the per-job files, or nullptr
+        threads = number of threads, 0 for one per hardware thread
  */
- // when passing an array by name, you're actually passing a pointer to the first element in the array
-    // thus, it'll modify the original array you passed in, not a copy
-    // passing an array by reference isn't a thing
-vector<uint16_t> execute(uint16_t mem[], uint16_t pc, uint16_t regs[]) {
-    // when accessing memory, only use the 13 lsb of the pc
-    // 8191 = 1111111111111
-    uint16_t mem_pc = pc & 8191;
-    uint16_t curr_instr = mem[mem_pc];
-    // tracks if you're instruction jumps or not
-    bool jump = false;
-    // increment program counter
-        // if instruction caused jump, will update new_pc later
-    uint16_t new_pc = pc + 1;
-    // tracks if instruction was a halt
-    bool halt = false;
-    // & curr_instr with 11100000000000000 to get 3 msb
-    int three_msb = curr_instr & 57344;
-    three_msb = three_msb >> 13;
-    // 3 register arguments
-    if (three_msb == 0) {
-        // 15 = 0000000000001111
-        int four_lsb = curr_instr & 15;
-        // 7168 = 0001110000000000
-        int srcA = curr_instr & 7168;
-        srcA = srcA >> 10;
-        // 896 = 0000001110000000
-        int srcB = curr_instr & 896;
-        srcB = srcB >> 7;
-        int dst = curr_instr & 112;
-        dst = dst >> 4;
-        // register 0 is immutable
-        if (dst != 0) {
-            if (four_lsb == 0) {
-                // add
-                int val1 = regs[srcA];
-                int val2 = regs[srcB];
-                ALU(regs, val1, val2, dst, "add");
-            }
-            else if (four_lsb == 1) {
-                // sub
-                int val1 = regs[srcA];
-                int val2 = regs[srcB];
-                ALU(regs, val1, val2, dst, "sub");
-            }
-            else if (four_lsb == 2) {
-                // or
-                uint16_t bitwise_or = regs[srcA] | regs[srcB];
-                regs[dst] = bitwise_or;
-            }
-            else if (four_lsb == 3) {
-                // and
-                uint16_t bitwise_and = regs[srcA] & regs[srcB];
-                regs[dst] = bitwise_and;
-            }
-            else if (four_lsb == 4) {
-                // slt
-                uint16_t val1 = regs[srcA];
-                uint16_t val2 = regs[srcB];
-                less_than(regs, val1, val2, dst);
-            }
-        }
-        // jr doesn't modify regDst
-            // thus, it doesn't matter if regDst == 0
-        if (four_lsb == 8) {
-            // jr
-            new_pc = regs[srcA];
-            jump = true;
+int run_batch(const char *manifest, const char *output_dir, size_t threads) {
+    vector<BatchJob> jobs;
+    if (!read_manifest(manifest, jobs))
+        return 1;
+    threads = pool_threads(threads);
+    vector<unique_ptr<Machine>> machines;
+    for (size_t t = 0; t < threads; t++)
+        machines.emplace_back(new Machine());
+    run_pool(jobs.size(), threads, [&](size_t job, size_t thread) {
+        run_batch_job(jobs[job], *machines[thread]);
+    });
+    int status = 0;
+    for (size_t k = 0; k < jobs.size(); k++) {
+        if (jobs[k].failed) {
+            cerr << "Job " << k << " (" << jobs[k].code << ") failed: " << jobs[k].output;
+            status = 1;
         }
-    }
-    // no register arguments
-    else if ((three_msb == 2) | (three_msb == 3)) {
-        // 8191 = 0001111111111111
-        // imm = non-negative absolute address
-        int imm = curr_instr & 8191;
-        if (three_msb == 2) {
-            // j
-            new_pc = imm;
-            jump = true;
-            // check for halt
-            if (new_pc == pc) {
-                halt = true;
+        if (output_dir != nullptr) {
+            string name = string(output_dir) + "/job" + to_string(k) + ".out";
+            ofstream out(name);
+            if (!out.is_open()) {
+                cerr << "Can't open file "<<name<<endl;
+                return 1;
             }
+            out << jobs[k].output;
         }
-        else { // three_msb == 3
-            // jal
-            // ****************
-            regs[7] = pc + 1;
-            new_pc = imm;
-            jump = true;
-        }
-    }
-    // two register arguments
-    else {
-        int src = curr_instr & 7168;
-        src = src >> 10;
-        int dst = curr_instr & 896;
-        dst = dst >> 7;
-        // 127 = 0000000001111111
-        int imm = curr_instr & 127;
-        // slti, lw, addi
-        if (dst != 0) {
-            if (three_msb == 7) {
-                // slti
-                // only op where imm = unsigned
-                uint16_t val1 = regs[src];
-                imm = sign_extend(imm, 7);
-                less_than(regs, val1, imm, dst);
-            }
-            else if (three_msb == 4) {
-                // lw
-                int addr = regs[src];
-                // check if imm is negative
-                imm = find_twos_complement(imm, 7);
-                // only least significant 13 bits of mem_addr are used to index into memory
-                int mem_addr = (imm + addr) & 8191;
-                int read_from_memory = mem[mem_addr];
-                regs[dst] = read_from_memory;
-            }
-            else if (three_msb == 1) {
-                // addi
-                int val1 = regs[src];
-                imm = find_twos_complement(imm, 7);
-                ALU(regs, val1, imm, dst, "addi");
-            }
-        }
-        // sw & jeq don't modify regDst
-            // thus, it doesn't matter if regDst == 0
-        if (three_msb == 5) {
-            // sw
-            int addr = regs[src];
-            imm = find_twos_complement(imm, 7);
-            int mem_addr = (imm + addr) & 8191;
-            int write_to_memory = regs[dst];
-            mem[mem_addr] = write_to_memory;
-        }
-        else if (three_msb == 6){
-            // jeq
-            int val1 = regs[src];
-            int val2 = regs[dst];
-            if (val1 == val2) {
-                // jump
-                // sign extend the rel_imm and find out if its
-                // imm = rel_imm
-                imm = find_twos_complement(imm, 7);
-                new_pc = pc + imm + 1;
-                jump = true;
-            }
+        else {
+            cout << "Job " << k << ": " << jobs[k].code;
+            if (jobs[k].init.size() > 0)
+                cout << " " << jobs[k].init;
+            cout << endl << jobs[k].output;
         }
-
-    }
-    uint16_t stop;
-    if (halt) {
-        stop = 1;
     }
-    else {
-        stop = 0;
-    }
-    vector<uint16_t> return_vals;
-    return_vals.push_back(new_pc);
-    return_vals.push_back(stop);
-    return return_vals;
+    return status;
 }
 
 /*
@@ -362,6 +212,17 @@ int main(int argc, char *argv[]) {
         Parse the command-line arguments
     */
     char *filename = nullptr;
+    string engine = "switch";
+    char *images = nullptr;
+    char *manifest = nullptr;
+    char *output_dir = nullptr;
+    size_t threads = 0;
+    char *checkpoint = nullptr;
+    uint64_t checkpoint_every = 0;
+    char *restore = nullptr;
+    bool do_stats = false;
+    char *trace_text = nullptr;
+    char *trace_bin = nullptr;
     bool do_help = false;
     bool arg_error = false;
     for (int i=1; i<argc; i++) {
@@ -369,6 +230,55 @@ int main(int argc, char *argv[]) {
         if (arg.rfind("-",0)==0) {
             if (arg== "-h" || arg == "--help")
                 do_help = true;
+            else if (arg=="--stats")
+                do_stats = true;
+            else if (arg=="--engine") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    engine = argv[i];
+            }
+            else if (arg=="--ensemble") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    images = argv[i];
+            }
+            else if (arg=="--batch" || arg=="--batch-output" || arg=="--threads") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else if (arg=="--batch")
+                    manifest = argv[i];
+                else if (arg=="--batch-output")
+                    output_dir = argv[i];
+                else if (!string(argv[i]).empty() && string(argv[i]).size() <= 19 &&
+                        string(argv[i]).find_first_not_of("0123456789") == string::npos)
+                    threads = stoul(argv[i]);
+                else
+                    arg_error = true;
+            }
+            else if (arg=="--checkpoint" || arg=="--checkpoint-every" || arg=="--restore" ||
+                    arg=="--trace-text" || arg=="--trace") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else if (arg=="--trace-text")
+                    trace_text = argv[i];
+                else if (arg=="--trace")
+                    trace_bin = argv[i];
+                else if (arg=="--checkpoint")
+                    checkpoint = argv[i];
+                else if (arg=="--restore")
+                    restore = argv[i];
+                else if (!string(argv[i]).empty() && string(argv[i]).size() <= 19 &&
+                        string(argv[i]).find_first_not_of("0123456789") == string::npos)
+                    checkpoint_every = stoull(argv[i]);
+                else
+                    arg_error = true;
+            }
             else
                 arg_error = true;
         } else {
@@ -378,43 +288,166 @@ int main(int argc, char *argv[]) {
                 arg_error = true;
         }
     }
+    if (engine != "switch" && engine != "threaded" && engine != "block" &&
+            engine != "jit" && engine != "jit-check")
+        arg_error = true;
+    if (checkpoint_every > 0 && checkpoint == nullptr)
+        arg_error = true;
+    // a checkpoint holds the program, so there is no filename to load as well
+    if (restore != nullptr && filename != nullptr)
+        arg_error = true;
     /* Display error message if appropriate */
-//    if (arg_error || do_help || filename == nullptr) {
-//        cerr << "usage " << argv[0] << " [-h] filename" << endl << endl;
-//        cerr << "Simulate E20 machine" << endl << endl;
-//        cerr << "positional arguments:" << endl;
-//        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
-//        cerr << "optional arguments:"<<endl;
-//        cerr << "  -h, --help  show this help message and exit"<<endl;
-//        return 1;
-//    }
-//    ifstream f(filename);
-    ifstream f("hw7q1.txt");
-    if (!f.is_open()) {
-        cerr << "Can't open file "<<filename<<endl;
+    if (arg_error || do_help || (filename == nullptr && manifest == nullptr && restore == nullptr)) {
+        cerr << "usage " << argv[0] << " [-h] [--engine ENGINE] [--ensemble IMAGES] [--stats]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--trace-text FILE] [--trace FILE]" << endl;
+        cerr << "      " << argv[0] << " [--checkpoint FILE [--checkpoint-every N]] filename" << endl;
+        cerr << "      " << argv[0] << " [--checkpoint FILE [--checkpoint-every N]] --restore FILE" << endl;
+        cerr << "      " << argv[0] << " --batch MANIFEST [--batch-output DIR] [--threads N]" << endl << endl;
+        cerr << "Simulate E20 machine" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing machine code, typically with .bin suffix,"<<endl;
+        cerr << "              or an .e20bin image written by asm --e20bin" << endl<<endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --engine ENGINE  Interpreter core: switch (default), threaded, or block"<<endl;
+        cerr << "                   (translates basic blocks and caches them), jit"<<endl;
+        cerr << "                   (compiles hot blocks to x86-64, Linux only), or"<<endl;
+        cerr << "                   jit-check (jit, checked against the interpreter after"<<endl;
+        cerr << "                   every compiled block)"<<endl;
+        cerr << "  --ensemble IMAGES  File listing one memory image per line (machine code"<<endl;
+        cerr << "                   files loaded on top of filename); runs every image in"<<endl;
+        cerr << "                   lockstep and prints the final state of each"<<endl;
+        cerr << "  --batch MANIFEST  Run every job listed in MANIFEST, one per line as"<<endl;
+        cerr << "                   \"code [init] [limit]\": a machine code file, an optional"<<endl;
+        cerr << "                   machine code file loaded on top of it, and an optional"<<endl;
+        cerr << "                   instruction limit"<<endl;
+        cerr << "  --batch-output DIR  Write the final state of job k to DIR/jobk.out instead"<<endl;
+        cerr << "                   of to standard output"<<endl;
+        cerr << "  --threads N      Threads for --batch (default: one per hardware thread)"<<endl;
+        cerr << "  --checkpoint FILE  Save a checkpoint to FILE.n (n = instructions executed)"<<endl;
+        cerr << "                   on SIGUSR1, and every N instructions with"<<endl;
+        cerr << "                   --checkpoint-every N; runs on the threaded core"<<endl;
+        cerr << "  --restore FILE   Resume from a checkpoint instead of loading filename"<<endl;
+        cerr << "  --stats          After the final state, print how often each instruction,"<<endl;
+        cerr << "                   and each address, was executed, and how often jeq was"<<endl;
+        cerr << "                   taken; runs on the threaded core"<<endl;
+        cerr << "  --trace-text FILE  Write every instruction executed to FILE, with the"<<endl;
+        cerr << "                   address of every lw and sw and the outcome of every jeq;"<<endl;
+        cerr << "                   runs on the threaded core"<<endl;
+        cerr << "  --trace FILE     Record every pc executed, and the address and value of"<<endl;
+        cerr << "                   every lw and sw, to FILE in the compact .e20t format"<<endl;
+        cerr << "                   (see e20_trace.h); runs on the threaded core"<<endl;
         return 1;
     }
-    // TODO: your code here. Load f and parse using load_machine_code
-    // initialize processor state
+    if (manifest != nullptr) {
+        return run_batch(manifest, output_dir, threads);
+    }
+    // initialize processor state, then load it from the checkpoint or the program file
         // pc, regs, and mem are initialized to 0
         // have max 16 bits (uint16_t)
-    uint16_t pc = 0;
-    uint16_t regs[8] = {0};
-    uint16_t mem[8192] = {0};
-    load_machine_code(f, mem);
+    Machine m;
+    init_machine(m);
+    uint64_t executed = 0;
+    if (restore != nullptr) {
+        vector<uint8_t> extra;
+        string error;
+        if (!restore_checkpoint(restore, m, executed, extra, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
+    else {
+        string error;
+        if (!load_program(filename, m, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
 
-    // TODO: your code here. Do simulation.
-    bool halt = false;
-    while (halt == false) {
-        vector<uint16_t> return_vals = execute(mem, pc, regs);
-        pc = return_vals[0];
-        if (return_vals[1] == 1) {
-            halt = true;
+    // simulate: each image of an ensemble, or this one machine on the core its options need
+    if (images != nullptr) {
+        return run_ensemble(images, m);
+    }
+    unique_ptr<ExecStats> stats;
+    if (do_stats) {
+        stats.reset(new ExecStats());
+    }
+    ofstream trace_file;
+    unique_ptr<TextTrace> trace;
+    if (trace_text != nullptr) {
+        trace_file.open(trace_text);
+        if (!trace_file.is_open()) {
+            cerr << "Can't open file "<<trace_text<<endl;
+            return 1;
+        }
+        trace.reset(new TextTrace(trace_file));
+    }
+    unique_ptr<BinaryTrace> record;
+    if (trace_bin != nullptr) {
+        record.reset(new BinaryTrace());
+        string error;
+        if (!record->open(trace_bin, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
+    if (checkpoint != nullptr || stats || trace || record) {
+        // the threaded core, specialized for the features that are on
+        NoObserver no_cache;
+        with_policies(no_cache, trace.get(), record.get(), stats.get(), [&](auto &obs) {
+            if (checkpoint == nullptr) {
+                run(m, RUN_UNTIL_HALT, obs);
+                return;
+            }
+            install_checkpoint_signal();
+            run_with_checkpoints(m, executed, checkpoint_every, obs, [&]() {
+                string name = string(checkpoint) + "." + to_string(executed);
+                string error;
+                if (!write_checkpoint(name, m, executed, vector<uint8_t>(), error)) {
+                    cerr << error << endl;
+                    exit(1);
+                }
+            });
+        });
+    }
+    else if (engine == "threaded") {
+        run(m, RUN_UNTIL_HALT);
+    }
+    else if (engine == "block") {
+        unique_ptr<BlockEngine> blocks(new BlockEngine(m));
+        run_blocks(*blocks, RUN_UNTIL_HALT);
+    }
+    else if (engine == "jit" || engine == "jit-check") {
+        unique_ptr<JitEngine> jit(new JitEngine(m));
+        if (!jit_available(*jit)) {
+            cerr << "The JIT needs Linux on x86-64 and executable memory" << endl;
+            return 1;
+        }
+        unique_ptr<Machine> shadow;
+        if (engine == "jit-check") {
+            // keep blocks unlinked so every block is checked on its own
+            jit->linking = false;
+            shadow.reset(new Machine(m));
+        }
+        run_jit(*jit, RUN_UNTIL_HALT, shadow.get());
+    }
+    else {
+        while (!step(m)) {
+        }
+    }
+    if (record) {
+        string error;
+        if (!record->finish(error)) {
+            cerr << error << endl;
+            return 1;
         }
     }
 
-    // TODO: your code here. print the final state of the simulator before ending, using print_state
-    print_state(pc, regs, mem, 128);
+    // print the final state of the simulator before ending
+    print_state(m.pc, m.regs, m.mem, 128);
+    if (stats) {
+        print_stats(cout, *stats);
+    }
     return 0;
 }
 //ra0Eequ6ucie6Jei0koh6phishohm9
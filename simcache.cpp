@@ -12,489 +12,2438 @@ simcache.cpp
 #include <fstream>
 #include <limits>
 #include <iomanip>
-#include <regex>
 #include <cmath>
+#include <memory>
+#include <algorithm>
+#include <sstream>
+#include "e20.h"
+#include "e20_checkpoint.h"
+#include "e20_image.h"
+#include "e20_engine.h"
+#include "e20_pool.h"
 
 using namespace std;
 
-size_t const static MEM_SIZE = 1<<13;
+/*
+    Prints out the correctly-formatted configuration of a cache.
+
+    @param cache_name The name of the cache. "L1" to "L4"
+
+    @param size The total size of the cache, measured in memory cells.
+        Excludes metadata
+
+    @param assoc The associativity of the cache. One of [1,2,4,8,16]
+
+    @param blocksize The blocksize of the cache. One of [1,2,4,8,16,32,64])
+
+    @param num_rows The number of rows in the given cache.
+
+    @param replacement The replacement policy, if not LRU, or nullptr
+
+    @param write The write policy, if not write-through with write-allocate, or nullptr
+
+    @param inclusion The inclusion policy, if not NINE, or nullptr
+
+    @param prefetch The prefetcher, with its degree and distance, or nullptr for none
+*/
+void print_cache_config(const string &cache_name, int size, int assoc, int blocksize, int num_rows,
+        const char *replacement = nullptr, const char *write = nullptr, const char *inclusion = nullptr,
+        const char *prefetch = nullptr) {
+    cout << "Cache " << cache_name << " has size " << size <<
+        ", associativity " << assoc << ", blocksize " << blocksize <<
+        ", rows " << num_rows;
+    if (replacement != nullptr)
+        cout << ", replacement " << replacement;
+    if (write != nullptr)
+        cout << ", write " << write;
+    if (inclusion != nullptr)
+        cout << ", inclusion " << inclusion;
+    if (prefetch != nullptr)
+        cout << ", prefetch " << prefetch;
+    cout << endl;
+}
+
+/*
+    Prints out a correctly-formatted log entry.
+
+    @param cache_name The name of the cache where the event
+        occurred. "L1" or "L2"
+
+    @param status The kind of cache event. "SW", "HIT", or
+        "MISS"
+
+    @param pc The program counter of the memory
+        access instruction
+
+    @param addr The memory address being accessed.
+
+    @param row The cache row or set number where the data
+        is stored.
+*/
+void print_log_entry(const string &cache_name, const string &status, int pc, int addr, int row) {
+    cout << left << setw(8) << cache_name + " " + status <<  right <<
+        " pc:" << setw(5) << pc <<
+        "\taddr:" << setw(5) << addr <<
+        "\trow:" << setw(4) << row << endl;
+}
+
+/*
+    Replacement
+    which line of a full row a cache evicts
+        REPL_LRU = least recently used
+        REPL_PLRU = tree pseudo-LRU, as hardware does it: one bit per node of a binary tree
+            over the ways, pointing away from the most recently used half
+        REPL_FIFO = first filled
+        REPL_RANDOM = any line, from a seeded generator
+        REPL_SRRIP = static re-reference interval prediction, with 2 bit predictions
+        REPL_BRRIP = bimodal RRIP: like SRRIP, but most fills are predicted distant
+        REPL_OPT = Belady's optimal policy: the line used again furthest in the future;
+            needs the accesses ahead of time, so only L1 of a --replay or --sweep can use it
+ */
+enum Replacement { REPL_LRU, REPL_PLRU, REPL_FIFO, REPL_RANDOM, REPL_SRRIP, REPL_BRRIP, REPL_OPT };
+
+// names --replacement accepts, in Replacement order
+const char *const REPLACEMENT_NAMES[] = {"lru", "plru", "fifo", "random", "srrip", "brrip", "opt"};
+
+/*
+    WritePolicy
+    what a cache does with a sw, or with a dirty block written back from the level above
+        WRITE_THROUGH = passes every write on to the next level, or memory; a miss allocates
+            a line without fetching the block, since the write goes on to the next level anyway
+        WRITE_THROUGH_NOALLOC = passes every write on; a miss doesn't allocate
+        WRITE_BACK = keeps writes in dirty lines, which are written back to the next level when
+            evicted; a miss allocates a line, first fetching the block from the next level
+            unless the write covers all of it
+        WRITE_BACK_NOALLOC = keeps writes to the lines it holds; a miss passes the write on
+ */
+enum WritePolicy { WRITE_THROUGH, WRITE_THROUGH_NOALLOC, WRITE_BACK, WRITE_BACK_NOALLOC };
+
+// names --write accepts, in WritePolicy order
+const char *const WRITE_POLICY_NAMES[] = {"wt", "wt-noalloc", "wb", "wb-noalloc"};
+
+/*
+    Inclusion
+    how a cache's contents relate to the level above it (L1 is always NINE)
+        NINE = non-inclusive non-exclusive: nothing is enforced
+        INCLUSIVE = holds every block of the levels above: a block it evicts is
+            invalidated above ("INV" in the log), and their dirty copies written back with it;
+            its blocksize must be a multiple of theirs, and it must be write-allocate
+        EXCLUSIVE = holds no block of the level above, as a victim cache for it: a block
+            evicted from the level above, clean or dirty, moves into it, and a read that hits
+            moves the block up out of it; it never allocates on a write, and its blocksize
+            must be that of the level above
+ */
+enum Inclusion { NINE, INCLUSIVE, EXCLUSIVE };
+
+// names --inclusion accepts, in Inclusion order
+const char *const INCLUSION_NAMES[] = {"nine", "inclusive", "exclusive"};
+
+/*
+    Prefetcher
+    what a cache reads ahead of the reads reaching it (lw, and reads from the level above),
+        degree blocks at a time, starting distance blocks (or strides) ahead; a prefetched
+        block that a read or write uses before it's evicted is a useful prefetch
+        PREFETCH_NONE = nothing
+        PREFETCH_NEXTLINE = tagged next-line: a miss, or the first use of a prefetched block,
+            prefetches the blocks distance to distance + degree - 1 after its own
+        PREFETCH_STRIDE = a table of STRIDE_ENTRIES entries, indexed by the pc of the lw, of
+            its last address and stride; once a pc repeats its stride, each of its reads
+            prefetches degree blocks from distance strides ahead (a stride within a block
+            moves on a block at a time)
+        PREFETCH_STREAM = STREAM_BUFFERS stream buffers of degree blocks beside the cache: a miss
+            that isn't in any fills the oldest with the blocks from distance after its own;
+            a miss that is moves the block into the cache, as a hit, drops the blocks ahead
+            of it, and the buffer prefetches as many again after its last one
+ */
+enum Prefetcher { PREFETCH_NONE, PREFETCH_NEXTLINE, PREFETCH_STRIDE, PREFETCH_STREAM };
+
+// names --prefetch accepts, in Prefetcher order
+const char *const PREFETCHER_NAMES[] = {"none", "nextline", "stride", "stream"};
+
+int const static STRIDE_ENTRIES = 64;
+int const static STREAM_BUFFERS = 4;
+
+// largest degree and distance a prefetcher takes
+int const static MAX_PREFETCH = 64;
+
+/*
+    PrefetchConfig
+    a level's prefetcher, as given on the command line
+        kind = the prefetcher
+        degree = blocks prefetched at a time, or blocks per stream buffer
+        distance = how far ahead the prefetches start, in blocks (or strides)
+ */
+struct PrefetchConfig {
+    Prefetcher kind;
+    int degree;
+    int distance;
+};
+
+// most levels of cache simcache simulates
+int const static MAX_LEVELS = 4;
+
+/*
+    LevelConfig
+    configuration of one level of cache, as given on the command line
+        size, assoc, blocksize = geometry: size in words, associativity, blocksize in words
+        replacement, write, inclusion = policies
+        prefetch = prefetcher, none if left out
+ */
+struct LevelConfig {
+    int size;
+    int assoc;
+    int blocksize;
+    Replacement replacement;
+    WritePolicy write;
+    Inclusion inclusion;
+    PrefetchConfig prefetch;
+};
+
+/*
+    StrideEntry
+    an entry of a stride prefetcher's table
+        pc = pc of the lw it follows, -1 if none
+        last = address that lw last read
+        stride = difference between its last two addresses
+ */
+struct StrideEntry {
+    int pc;
+    int last;
+    int stride;
+};
+
+/*
+    Cache
+    one level of simulated cache, kept in flat arrays and updated in place:
+        way w of row r is line r * assoc + w
+    members:
+        blocksize, num_rows, assoc = geometry of the cache
+        replacement = replacement policy
+        write_back, write_allocate = write policy
+        inclusion = relation to the level above
+        tags[] = tag held by each line
+        valid[] = whether each line holds a block
+        dirty[] = whether each line holds writes not yet written back
+        age[] = per line state of the replacement policy: when it was last used (LRU), when it
+            was filled (FIFO), its re-reference prediction (SRRIP, BRRIP), or when it will
+            next be used (OPT)
+        tree[] = per row: the tree-PLRU bits, node n (1 = the root, children 2n and 2n + 1) in bit n
+        clock = number of uses so far
+        rng = state of the random number generator
+        next_use = for OPT: when the block being accessed will next be used, set before each access
+        prefetch, degree, distance = prefetcher
+        prefetched[] = with a prefetcher, whether each line holds a prefetched block not used yet
+        prefetch_time[] = when each line's block was prefetched, in the observer's accesses
+        evicted_by_prefetch[] = per block of memory: whether a prefetch evicted it, since it
+            was last brought back
+        strides[] = for PREFETCH_STRIDE, the table
+        stream_blocks[] = for PREFETCH_STREAM, buffer b's blocks from b * degree, next first, or -1
+            if none, or invalidated by an inclusive level below
+        stream_time[] = when each block of the stream buffers was prefetched
+        stream_last[] = per stream buffer: the last block it prefetched, -1 if none
+        stream_next = the stream buffer filled longest ago
+ */
+struct Cache {
+    int blocksize;
+    int num_rows;
+    int assoc;
+    Replacement replacement;
+    bool write_back;
+    bool write_allocate;
+    Inclusion inclusion;
+    vector<int> tags;
+    vector<uint8_t> valid;
+    vector<uint8_t> dirty;
+    vector<uint64_t> age;
+    vector<uint64_t> tree;
+    uint64_t clock;
+    uint64_t rng;
+    uint64_t next_use;
+    Prefetcher prefetch;
+    int degree;
+    int distance;
+    vector<uint8_t> prefetched;
+    vector<uint64_t> prefetch_time;
+    vector<uint8_t> evicted_by_prefetch;
+    vector<StrideEntry> strides;
+    vector<int> stream_blocks;
+    vector<uint64_t> stream_time;
+    vector<int> stream_last;
+    int stream_next;
+};
+
+// number of blocks of blocksize words memory holds, the last maybe partly
+inline int blocks_in_memory(int blocksize) {
+    return (MEM_SIZE + blocksize - 1) / blocksize;
+}
+
+/*
+    create_cache(config, seed)
+    creates an empty cache
+    parameters:
+        config = configuration of the cache, checked by check_hierarchy
+        seed = seed of the random number generator, for REPL_RANDOM and REPL_BRRIP
+ */
+Cache create_cache(const LevelConfig &config, uint64_t seed = 1) {
+    Cache cache;
+    int blocksize = config.blocksize;
+    int assoc = config.assoc;
+    int num_rows = config.size / assoc / blocksize;
+    Replacement replacement = config.replacement;
+    cache.blocksize = blocksize;
+    cache.num_rows = num_rows;
+    cache.assoc = assoc;
+    cache.replacement = replacement;
+    cache.write_back = config.write == WRITE_BACK || config.write == WRITE_BACK_NOALLOC;
+    cache.write_allocate = config.write == WRITE_THROUGH || config.write == WRITE_BACK;
+    cache.inclusion = config.inclusion;
+    cache.tags.assign((size_t)num_rows * assoc, 0);
+    cache.valid.assign((size_t)num_rows * assoc, 0);
+    cache.dirty.assign((size_t)num_rows * assoc, 0);
+    cache.age.assign((size_t)num_rows * assoc, 0);
+    cache.tree.assign(replacement == REPL_PLRU ? num_rows : 0, 0);
+    cache.clock = 0;
+    // xorshift needs a state other than 0
+    cache.rng = (seed + 1) * 0x9E3779B97F4A7C15ULL | 1;
+    cache.next_use = 0;
+    cache.prefetch = config.prefetch.kind;
+    cache.degree = config.prefetch.degree;
+    cache.distance = config.prefetch.distance;
+    bool prefetching = cache.prefetch != PREFETCH_NONE;
+    cache.prefetched.assign(prefetching ? (size_t)num_rows * assoc : 0, 0);
+    cache.prefetch_time.assign(prefetching ? (size_t)num_rows * assoc : 0, 0);
+    cache.evicted_by_prefetch.assign(prefetching ? blocks_in_memory(blocksize) : 0, 0);
+    cache.strides.assign(cache.prefetch == PREFETCH_STRIDE ? STRIDE_ENTRIES : 0, {-1, 0, 0});
+    cache.stream_blocks.assign(cache.prefetch == PREFETCH_STREAM ? STREAM_BUFFERS * cache.degree : 0, -1);
+    cache.stream_time.assign(cache.stream_blocks.size(), 0);
+    cache.stream_last.assign(cache.prefetch == PREFETCH_STREAM ? STREAM_BUFFERS : 0, -1);
+    cache.stream_next = 0;
+    return cache;
+}
+
+/*
+    cache_random(cache)
+    returns the next number from the cache's random number generator (xorshift64*)
+ */
+inline uint64_t cache_random(Cache &cache) {
+    cache.rng ^= cache.rng >> 12;
+    cache.rng ^= cache.rng << 25;
+    cache.rng ^= cache.rng >> 27;
+    return cache.rng * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+    replacement policies
+    each is a struct of static functions, so the cache functions are instantiated
+        for one policy at a time with its bookkeeping inlined
+        used(cache, row, line, fill) = records a use of line, which is in row;
+            fill is true if its block was just brought in
+        victim(cache, row) = returns the line to evict from row, which is full
+ */
+struct LruPolicy {
+    static void used(Cache &cache, int, int line, bool) {
+        cache.age[line] = ++cache.clock;
+    }
+
+    static int victim(Cache &cache, int row) {
+        int first = row * cache.assoc;
+        int victim = first;
+        for (int line = first + 1; line < first + cache.assoc; line++) {
+            if (cache.age[line] < cache.age[victim])
+                victim = line;
+        }
+        return victim;
+    }
+};
+
+struct FifoPolicy : LruPolicy {
+    static void used(Cache &cache, int, int line, bool fill) {
+        if (fill)
+            cache.age[line] = ++cache.clock;
+    }
+};
+
+struct TreePlruPolicy {
+    static void used(Cache &cache, int row, int line, bool) {
+        uint64_t &bits = cache.tree[row];
+        int way = line - row * cache.assoc;
+        // from the root down to way, pointing each node at the half way isn't in
+        int node = 1;
+        for (int half = cache.assoc / 2; half > 0; half /= 2) {
+            int right = (way & half) != 0;
+            if (right)
+                bits &= ~(1ULL << node);
+            else
+                bits |= 1ULL << node;
+            node = 2 * node + right;
+        }
+    }
+
+    static int victim(Cache &cache, int row) {
+        uint64_t bits = cache.tree[row];
+        int way = 0;
+        int node = 1;
+        for (int half = cache.assoc / 2; half > 0; half /= 2) {
+            int right = (bits >> node) & 1;
+            way += right * half;
+            node = 2 * node + right;
+        }
+        return row * cache.assoc + way;
+    }
+};
+
+struct RandomPolicy {
+    static void used(Cache &, int, int, bool) {
+    }
+
+    static int victim(Cache &cache, int row) {
+        return row * cache.assoc + cache_random(cache) % cache.assoc;
+    }
+};
+
+// largest re-reference prediction: a line predicted to be used again in the distant future
+uint64_t const static RRPV_MAX = 3;
+
+struct SrripPolicy {
+    static void used(Cache &cache, int, int line, bool fill) {
+        cache.age[line] = fill ? RRPV_MAX - 1 : 0;
+    }
+
+    // the first line predicted distant, after ageing the row until there is one
+    static int victim(Cache &cache, int row) {
+        int first = row * cache.assoc;
+        int victim = first;
+        for (int line = first + 1; line < first + cache.assoc; line++) {
+            if (cache.age[line] > cache.age[victim])
+                victim = line;
+        }
+        uint64_t ageing = RRPV_MAX - cache.age[victim];
+        for (int line = first; line < first + cache.assoc; line++)
+            cache.age[line] += ageing;
+        return victim;
+    }
+};
+
+struct BrripPolicy : SrripPolicy {
+    static void used(Cache &cache, int, int line, bool fill) {
+        if (!fill)
+            cache.age[line] = 0;
+        else
+            cache.age[line] = cache_random(cache) % 32 == 0 ? RRPV_MAX - 1 : RRPV_MAX;
+    }
+};
+
+struct OptPolicy {
+    static void used(Cache &cache, int, int line, bool) {
+        cache.age[line] = cache.next_use;
+    }
+
+    static int victim(Cache &cache, int row) {
+        int first = row * cache.assoc;
+        int victim = first;
+        for (int line = first + 1; line < first + cache.assoc; line++) {
+            if (cache.age[line] > cache.age[victim])
+                victim = line;
+        }
+        return victim;
+    }
+};
+
+/*
+    with_replacement(cache, f)
+    calls f with the policy struct of the cache's replacement policy, e.g.
+        with_replacement(cache, [&](auto policy) { add_tag<decltype(policy)>(cache, row, tag); });
+ */
+template <typename F>
+inline auto with_replacement(const Cache &cache, F f) -> decltype(f(LruPolicy())) {
+    switch (cache.replacement) {
+    case REPL_PLRU:
+        return f(TreePlruPolicy());
+    case REPL_FIFO:
+        return f(FifoPolicy());
+    case REPL_RANDOM:
+        return f(RandomPolicy());
+    case REPL_SRRIP:
+        return f(SrripPolicy());
+    case REPL_BRRIP:
+        return f(BrripPolicy());
+    case REPL_OPT:
+        return f(OptPolicy());
+    default:
+        return f(LruPolicy());
+    }
+}
+
+/*
+    check_hierarchy(levels, error, icache)
+    returns false, with a description in error, if the levels of cache, L1 first,
+        and the instruction cache, if any, can't be simulated together
+ */
+bool check_hierarchy(const vector<LevelConfig> &levels, string &error, const LevelConfig *icache = nullptr) {
+    if (levels.empty() || levels.size() > (size_t)MAX_LEVELS) {
+        error = "Invalid cache config: 1 to " + to_string(MAX_LEVELS) + " levels";
+        return false;
+    }
+    if (icache != nullptr) {
+        const LevelConfig &c = *icache;
+        string name = "Invalid cache config for L1I: ";
+        if (c.assoc <= 0 || c.blocksize <= 0 || c.blocksize > (int)MEM_SIZE || c.size / c.assoc / c.blocksize <= 0)
+            error = name + "size must be at least associativity times blocksize";
+        else if (c.replacement == REPL_PLRU && (c.assoc > 64 || (c.assoc & (c.assoc - 1)) != 0))
+            error = name + "plru needs a power of two associativity, at most 64";
+        // the lookahead is kept for the data accesses only
+        else if (c.replacement == REPL_OPT)
+            error = name + "only L1 can use opt";
+        else if (c.inclusion != NINE)
+            error = name + "L1 has no level above to include or exclude";
+        else if (c.prefetch.kind != PREFETCH_NONE)
+            error = name + "only data caches prefetch";
+        // a level exclusive of both L1s would have to take the victims of each
+        else if (levels.size() > 1 && levels[1].inclusion == EXCLUSIVE)
+            error = name + "L2 can't be exclusive of a split L1";
+        if (!error.empty())
+            return false;
+    }
+    for (size_t level = 0; level < levels.size(); level++) {
+        const LevelConfig &c = levels[level];
+        string name = "Invalid cache config for L" + to_string(level + 1) + ": ";
+        if (c.assoc <= 0 || c.blocksize <= 0 || c.blocksize > (int)MEM_SIZE || c.size / c.assoc / c.blocksize <= 0)
+            error = name + "size must be at least associativity times blocksize";
+        // tree-PLRU needs a full binary tree, with its nodes in a 64 bit word
+        else if (c.replacement == REPL_PLRU && (c.assoc > 64 || (c.assoc & (c.assoc - 1)) != 0))
+            error = name + "plru needs a power of two associativity, at most 64";
+        else if (c.replacement == REPL_OPT && level > 0)
+            error = name + "only L1 can use opt";
+        else if (c.inclusion != NINE && level == 0)
+            error = name + "L1 has no level above to include or exclude";
+        else if (c.inclusion == INCLUSIVE && (c.write == WRITE_THROUGH_NOALLOC || c.write == WRITE_BACK_NOALLOC))
+            error = name + "an inclusive cache must be write-allocate";
+        else if (c.inclusion == EXCLUSIVE && c.blocksize != levels[level - 1].blocksize)
+            error = name + "an exclusive cache needs the blocksize of the level above";
+        else if (c.prefetch.kind != PREFETCH_NONE && (c.prefetch.degree < 1 || c.prefetch.degree > MAX_PREFETCH ||
+                c.prefetch.distance < 1 || c.prefetch.distance > MAX_PREFETCH))
+            error = name + "prefetch degree and distance must be 1 to " + to_string(MAX_PREFETCH);
+        // it holds only what the level above evicts
+        else if (c.prefetch.kind != PREFETCH_NONE && c.inclusion == EXCLUSIVE)
+            error = name + "an exclusive cache can't prefetch";
+        // OPT's lookahead only knows when the block being accessed is next used
+        else if (c.prefetch.kind != PREFETCH_NONE && c.replacement == REPL_OPT)
+            error = name + "opt can't be used with a prefetcher";
+        // a stream buffer would have to take its blocks out of the level below
+        else if (c.prefetch.kind == PREFETCH_STREAM && level + 1 < levels.size() &&
+                levels[level + 1].inclusion == EXCLUSIVE)
+            error = name + "stream buffers can't read from an exclusive cache";
+        else if (c.inclusion == INCLUSIVE) {
+            for (size_t above = 0; above < level; above++) {
+                if (c.blocksize % levels[above].blocksize != 0 || (icache != nullptr && c.blocksize % icache->blocksize != 0))
+                    error = name + "an inclusive cache's blocksize must be a multiple of those above";
+            }
+        }
+        if (!error.empty())
+            return false;
+    }
+    return true;
+}
+
+/*
+    find_tag(cache, row, tag)
+    returns the line of row holding tag, or -1 if it isn't in the cache
+ */
+int find_tag(const Cache &cache, int row, int tag) {
+    int first = row * cache.assoc;
+    for (int line = first; line < first + cache.assoc; line++) {
+        if (cache.valid[line] && cache.tags[line] == tag)
+            return line;
+    }
+    return -1;
+}
+
+/*
+    add_tag<Policy>(cache, row, tag, dirty, evicted_dirty)
+    adds tag to row: into an empty line if there is one,
+        otherwise in place of the line Policy chooses
+    returns the block number of the block evicted, or -1 if none was
+    parameters:
+        cache = cache tag is being added to
+        row = cache row tag is being added to
+        tag = val being added to row
+        dirty = whether the new line is dirty
+        evicted_dirty = receives whether the block evicted was dirty
+ */
+template <typename Policy>
+int add_tag(Cache &cache, int row, int tag, bool dirty, bool &evicted_dirty) {
+    int first = row * cache.assoc;
+    int victim = -1;
+    for (int line = first; line < first + cache.assoc; line++) {
+        if (!cache.valid[line]) {
+            victim = line;
+            break;
+        }
+    }
+    int evicted = -1;
+    evicted_dirty = false;
+    if (victim < 0) {
+        victim = Policy::victim(cache, row);
+        evicted = cache.tags[victim] * cache.num_rows + row;
+        evicted_dirty = cache.dirty[victim];
+    }
+    cache.tags[victim] = tag;
+    cache.valid[victim] = 1;
+    cache.dirty[victim] = dirty;
+    Policy::used(cache, row, victim, true);
+    return evicted;
+}
+
+// row of cache that the block holding mem_addr maps to
+inline int cache_row(const Cache &cache, int mem_addr) {
+    return mem_addr / cache.blocksize % cache.num_rows;
+}
+
+/*
+    cache_use(cache, mem_addr)
+    calculates the desired tag/row for mem_addr and searches the cache for that tag/row combination,
+        telling the replacement policy of the use if it is there
+    returns the line holding it, or -1 if it isn't in the cache
+ */
+int cache_use(Cache &cache, int mem_addr) {
+    int blockid = mem_addr / cache.blocksize;
+    int row = blockid % cache.num_rows;
+    int line = find_tag(cache, row, blockid / cache.num_rows);
+    if (line >= 0) {
+        with_replacement(cache, [&](auto policy) {
+            decltype(policy)::used(cache, row, line, false);
+        });
+    }
+    return line;
+}
+
+/*
+    cache_fill(cache, mem_addr, dirty, evicted_dirty)
+    loads the block holding mem_addr, which isn't in the cache, to its row,
+        evicting the line the replacement policy chooses if the row is full
+    returns the block number of the block evicted, or -1 if none was
+    parameters:
+        cache = cache being filled
+        mem_addr = an address in the block
+        dirty = whether the new line is dirty
+        evicted_dirty = receives whether the block evicted was dirty
+ */
+int cache_fill(Cache &cache, int mem_addr, bool dirty, bool &evicted_dirty) {
+    int blockid = mem_addr / cache.blocksize;
+    return with_replacement(cache, [&](auto policy) {
+        return add_tag<decltype(policy)>(cache, blockid % cache.num_rows, blockid / cache.num_rows, dirty, evicted_dirty);
+    });
+}
+
+// keeps the code of an optional feature out of line, out of the way of the code every access runs
+#define E20_COLD __attribute__((noinline, cold))
+
+// names the log uses for each level of cache, L1 first
+const char *const CACHE_NAMES[] = {"L1", "L2", "L3", "L4"};
+
+// the level after level, of levels; memory counts as level levels
+constexpr int level_below(int level, int levels) {
+    return level < levels ? level + 1 : levels;
+}
+
+/*
+    LruStacks
+    the LRU stacks of every row of a cache with a given blocksize and number of rows,
+        for Mattson's stack distance analysis: with assoc blocks per row, a lw hits
+        exactly when fewer than assoc other blocks of its row were used since its own
+        block last was, so one pass gives the hits for every associativity at once
+        each row numbers its uses 1, 2, ...; a Fenwick tree marks the uses that are
+        still some block's latest, and counting the marks after a block's latest use
+        gives its distance in log time. When a row runs out of numbers its blocks are
+        renumbered in order, which happens at most once every per_row uses.
+    members:
+        blocksize, num_rows = geometry of the cache
+        per_row = number of distinct blocks that can map to one row
+        cap = uses a row can number before it is renumbered
+        last[] = per block: number of its latest use, 0 if never used
+        clock[] = per row: number of its next use
+        used[] = per row: number of distinct blocks used so far
+        tree[] = per row, cap + 1 entries: the Fenwick tree
+        hist[] = lw per stack distance (number of other blocks of the row used since)
+        cold = lw of blocks never used before
+        latest = scratch space for renumber
+ */
+struct LruStacks {
+    int blocksize;
+    int num_rows;
+    int per_row;
+    int cap;
+    vector<int> last;
+    vector<int> clock;
+    vector<int> used;
+    vector<int> tree;
+    vector<uint64_t> hist;
+    uint64_t cold;
+    vector<pair<int, int>> latest;
+
+    LruStacks(int blocksize, int num_rows) : blocksize(blocksize), num_rows(num_rows), cold(0) {
+        int blocks = blocks_in_memory(blocksize);
+        per_row = (blocks + num_rows - 1) / num_rows;
+        cap = 2 * per_row;
+        last.assign(blocks, 0);
+        clock.assign(num_rows, 1);
+        used.assign(num_rows, 0);
+        tree.assign((size_t)num_rows * (cap + 1), 0);
+        hist.assign(per_row, 0);
+    }
+
+    void mark(int *row_tree, int t, int delta) {
+        for (; t <= cap; t += t & -t)
+            row_tree[t] += delta;
+    }
+
+    int marks_through(const int *row_tree, int t) {
+        int sum = 0;
+        for (; t > 0; t -= t & -t)
+            sum += row_tree[t];
+        return sum;
+    }
+
+    // renumbers the latest uses of the blocks in row as 1, 2, ... in order
+    void renumber(int row) {
+        latest.clear();
+        for (int block = row; block < (int)last.size(); block += num_rows) {
+            if (last[block] > 0)
+                latest.push_back({last[block], block});
+        }
+        sort(latest.begin(), latest.end());
+        int *row_tree = &tree[(size_t)row * (cap + 1)];
+        fill(row_tree, row_tree + cap + 1, 0);
+        for (size_t i = 0; i < latest.size(); i++) {
+            last[latest[i].second] = i + 1;
+            mark(row_tree, i + 1, 1);
+        }
+        clock[row] = latest.size() + 1;
+    }
+
+    /*
+        touch(mem_addr)
+        records a use of the block holding mem_addr
+        returns its distance, or -1 if its block was never used before
+     */
+    int touch(int mem_addr) {
+        int block = mem_addr / blocksize;
+        int row = block % num_rows;
+        // already the most recently used block of its row: the stack doesn't change
+        if (last[block] != 0 && last[block] == clock[row] - 1)
+            return 0;
+        if (clock[row] > cap)
+            renumber(row);
+        int *row_tree = &tree[(size_t)row * (cap + 1)];
+        int prev = last[block];
+        int distance = -1;
+        if (prev == 0)
+            used[row]++;
+        else {
+            distance = used[row] - marks_through(row_tree, prev);
+            mark(row_tree, prev, -1);
+        }
+        last[block] = clock[row];
+        mark(row_tree, clock[row]++, 1);
+        return distance;
+    }
+
+    /*
+        use(mem_addr, is_lw)
+        records a use of the block holding mem_addr, counting its distance if it's a lw
+     */
+    void use(int mem_addr, bool is_lw) {
+        int distance = touch(mem_addr);
+        if (!is_lw)
+            return;
+        if (distance < 0)
+            cold++;
+        else
+            hist[distance]++;
+    }
+
+    /*
+        hits(assoc)
+        returns the number of lw that hit in the cache with assoc blocks per row
+     */
+    uint64_t hits(int assoc) const {
+        uint64_t sum = 0;
+        for (int d = 0; d < assoc && d < per_row; d++)
+            sum += hist[d];
+        return sum;
+    }
+};
+
+/*
+    CacheSummary
+    what --summary counts besides each level's reads: the sw reaching each level, a
+        classification of each level's misses, and the misses of each pc
+        a miss is compulsory if its block was never used in the level before, a capacity miss
+        if it would also miss in a fully associative LRU cache of the same number of blocks,
+        and a conflict miss otherwise; that cache's LRU stack (shadows[]) sees every read and
+        sw the level does
+    members:
+        shadows[] = per level: the fully associative cache, one row of LruStacks
+        blocks[] = per level: number of blocks it holds
+        store_hits[], store_misses[] = sw that hit and missed in each level
+        compulsory[], capacity[], conflict[] = each level's misses of each kind, lw and sw
+        pc_accesses[] = per pc: lw and sw
+        pc_misses[] = per level, per pc: misses, level l's from l * MEM_SIZE
+ */
+struct CacheSummary {
+    vector<LruStacks> shadows;
+    vector<int> blocks;
+    uint64_t store_hits[MAX_LEVELS] = {};
+    uint64_t store_misses[MAX_LEVELS] = {};
+    uint64_t compulsory[MAX_LEVELS] = {};
+    uint64_t capacity[MAX_LEVELS] = {};
+    uint64_t conflict[MAX_LEVELS] = {};
+    vector<uint64_t> pc_accesses;
+    vector<uint64_t> pc_misses;
+
+    CacheSummary(const vector<LevelConfig> &levels) : pc_accesses(MEM_SIZE), pc_misses(levels.size() * MEM_SIZE) {
+        for (const LevelConfig &c : levels) {
+            shadows.emplace_back(c.blocksize, 1);
+            blocks.push_back(c.size / c.blocksize);
+        }
+    }
+};
+
+/*
+    PendingPrefetch
+    a prefetch asked for during an access, made once the access is done
+        level = level prefetching
+        pc = pc of the access
+        mem_addr = an address in the block
+        into_cache = whether the block goes into the cache, or is only read from below, for a stream buffer
+ */
+struct PendingPrefetch {
+    int level;
+    uint16_t pc;
+    int mem_addr;
+    bool into_cache;
+};
+
+/*
+    CacheObserver<Levels, Fetch>
+    forwards every lw and sw the program makes to the simulated caches (see NoObserver)
+        a lw goes to L1, and on to the next level each time it misses; a sw goes to L1, and
+        on to the next level as each level's write policy says; a dirty block evicted from
+        a level is written back to the next one ("WB" in the log), the last level's to memory;
+        each level's inclusion policy is kept as Inclusion describes
+        with Fetch, every instruction fetch also goes to the L1 instruction cache icache, and
+        on to L2 (or memory) when it misses, without being logged; L2 and below hold both
+        instructions and data, and a sw invalidates its block in icache
+        a level with a prefetcher trains it on the reads reaching it, and reads the blocks it
+        asks for from below like a miss, but unlogged, and without counting them as reads
+        of the levels below or waiting for them (see Prefetcher)
+        Levels is fixed at compile time, and the levels are template arguments of the member
+        functions, so a run has only the code for its levels and the calls between them inline;
+        each access picks the code for its cache's replacement policy with one switch
+    members:
+        caches[] = array of caches, one per level, L1 first
+        log = whether to print a log entry for every access
+        icache = the L1 instruction cache, with Fetch
+        hits[], misses[] = reads that hit and missed in each level: lw, and the fetches
+            of a write-back, write-allocate level above
+        sws = number of sw
+        writebacks[] = dirty blocks evicted from each level
+        invalidations[] = blocks of each level invalidated by an inclusive level below
+        memory_reads, memory_writes = words read from and written to memory
+        memory_blocks = blocks read from memory, other than by prefetches
+        fetch_hits[], fetch_misses[] = instruction fetches that hit and missed in icache,
+            then in each level below L1
+        fetch_invalidations = blocks of icache invalidated by a sw or an inclusive level below
+        prefetches[] = blocks each level's prefetcher read from below
+        useful_prefetches[] = prefetched blocks used before being evicted, or dropped from
+            a stream buffer
+        useless_prefetches[] = prefetched blocks evicted, or dropped, without being used
+        prefetch_lead[] = accesses from each useful prefetch to its first use, added up
+        pollution[] = misses on blocks a prefetch evicted
+        pending = prefetches the access being made has asked for
+        summary = what --summary counts, or nullptr
+        aside = whether the read being made is a fetch or prefetch, which summary doesn't count
+        next_use = for an L1 with REPL_OPT: when each access's block will next be used, in access order
+        accesses = number of lw and sw, and with Fetch instruction fetches, so far
+ */
+template <int Levels, bool Fetch = false>
+struct CacheObserver : NoObserver {
+    static const bool sees_every_instruction = Fetch;
+    Cache *caches;
+    bool log;
+    Cache *icache;
+    uint64_t hits[Levels] = {};
+    uint64_t misses[Levels] = {};
+    uint64_t sws = 0;
+    uint64_t writebacks[Levels] = {};
+    uint64_t invalidations[Levels] = {};
+    uint64_t memory_reads = 0;
+    uint64_t memory_writes = 0;
+    uint64_t memory_blocks = 0;
+    uint64_t fetch_hits[Levels] = {};
+    uint64_t fetch_misses[Levels] = {};
+    uint64_t fetch_invalidations = 0;
+    uint64_t prefetches[Levels] = {};
+    uint64_t useful_prefetches[Levels] = {};
+    uint64_t useless_prefetches[Levels] = {};
+    uint64_t prefetch_lead[Levels] = {};
+    uint64_t pollution[Levels] = {};
+    vector<PendingPrefetch> pending;
+    CacheSummary *summary = nullptr;
+    bool aside = false;
+    const uint64_t *next_use = nullptr;
+    uint64_t accesses = 0;
+
+    CacheObserver(Cache *levels, bool log_accesses, Cache *fetch_cache) :
+        caches(levels), log(log_accesses), icache(fetch_cache) {}
+
+    // a read of the block holding mem_addr from level Level (memory if it is Levels), which
+    // fetches it from below on a miss; returns whether the block left an exclusive level dirty
+    template <int Level>
+    bool read(uint16_t pc, int mem_addr) {
+        if (Level == Levels) {
+            memory_reads += caches[Levels - 1].blocksize;
+            memory_blocks++;
+            return false;
+        }
+        Cache &cache = caches[Level];
+        int line = cache_use(cache, mem_addr);
+        bool streamed = line < 0 && cache.prefetch == PREFETCH_STREAM && in_stream(cache, mem_addr);
+        if (log)
+            print_log_entry(CACHE_NAMES[Level], line >= 0 || streamed ? "HIT" : "MISS", pc, mem_addr,
+                cache_row(cache, mem_addr));
+        if (summary != nullptr)
+            summarize<Level>(pc, mem_addr, line >= 0 || streamed, false);
+        if (streamed) {
+            hits[Level]++;
+            take_streamed<Level>(pc, mem_addr);
+            return false;
+        }
+        if (line >= 0) {
+            hits[Level]++;
+            if (cache.prefetch != PREFETCH_NONE)
+                train<Level>(pc, mem_addr, line, false);
+            if (cache.inclusion != EXCLUSIVE)
+                return false;
+            // the block moves up to the level above
+            bool dirty = cache.dirty[line];
+            cache.valid[line] = 0;
+            cache.dirty[line] = 0;
+            return dirty;
+        }
+        misses[Level]++;
+        if (cache.prefetch != PREFETCH_NONE && cache.evicted_by_prefetch[mem_addr / cache.blocksize])
+            pollution[Level]++;
+        bool dirty = read<level_below(Level, Levels)>(pc, mem_addr);
+        if (cache.inclusion == EXCLUSIVE)
+            return dirty;
+        fill<Level>(pc, mem_addr, dirty);
+        if (cache.prefetch != PREFETCH_NONE)
+            train<Level>(pc, mem_addr, -1, true);
+        return false;
+    }
+
+    // a write of words words from mem_addr to level Level, by a sw (logged) or a writeback
+    template <int Level>
+    void write(uint16_t pc, int mem_addr, int words, bool is_sw) {
+        if (Level == Levels) {
+            memory_writes += words;
+            return;
+        }
+        Cache &cache = caches[Level];
+        // a writeback from a level with larger blocks covers several blocks of this one
+        int block_end = (mem_addr / cache.blocksize + 1) * cache.blocksize;
+        if (mem_addr + words > block_end) {
+            for (int end = mem_addr + words; mem_addr < end; mem_addr = block_end, block_end += cache.blocksize)
+                write<Level>(pc, mem_addr, min(end, block_end) - mem_addr, false);
+            return;
+        }
+        int line = cache_use(cache, mem_addr);
+        if (line >= 0) {
+            cache.dirty[line] |= cache.write_back;
+            if (cache.prefetch != PREFETCH_NONE)
+                first_use<Level>(line);
+        }
+        if (log && is_sw)
+            print_log_entry(CACHE_NAMES[Level], "SW", pc, mem_addr, cache_row(cache, mem_addr));
+        if (summary != nullptr && is_sw)
+            summarize<Level>(pc, mem_addr, line >= 0, true);
+        bool allocate = line < 0 && cache.write_allocate && cache.inclusion != EXCLUSIVE;
+        if (allocate) {
+            // a new dirty line needs the rest of its block
+            bool fetch = cache.write_back && words < cache.blocksize;
+            if (fetch)
+                fill<Level>(pc, mem_addr, read<level_below(Level, Levels)>(pc, mem_addr) || cache.write_back);
+            else
+                place<Level>(pc, mem_addr, cache.write_back);
+            if (cache.write_back && !fetch)
+                include<level_below(Level, Levels)>(pc, mem_addr);
+        }
+        if (!cache.write_back || (line < 0 && !allocate))
+            write<level_below(Level, Levels)>(pc, mem_addr, words, is_sw);
+    }
+
+    // brings the block holding mem_addr into level Level, then disposes of the block it evicts
+    template <int Level>
+    void fill(uint16_t pc, int mem_addr, bool dirty, bool prefetched = false) {
+        Cache &cache = caches[Level];
+        bool evicted_dirty;
+        int evicted = cache_fill(cache, mem_addr, dirty, evicted_dirty);
+        if (cache.prefetch != PREFETCH_NONE)
+            filled<Level>(mem_addr, evicted, prefetched);
+        if (evicted >= 0)
+            evict<Level>(pc, evicted, evicted_dirty);
+    }
+
+    // brings the block holding mem_addr into level Level without reading it from below, taking
+    // it, dirty or not, from the level below if that is exclusive
+    template <int Level>
+    void place(uint16_t pc, int mem_addr, bool dirty) {
+        const int below = level_below(Level, Levels);
+        if (below < Levels && caches[below].inclusion == EXCLUSIVE) {
+            Cache &cache = caches[below];
+            int line = find_tag(cache, cache_row(cache, mem_addr), mem_addr / cache.blocksize / cache.num_rows);
+            if (line >= 0) {
+                dirty |= cache.dirty[line];
+                cache.valid[line] = 0;
+                cache.dirty[line] = 0;
+            }
+        }
+        fill<Level>(pc, mem_addr, dirty);
+    }
+
+    // the block number block has left level Level: it is invalidated above an inclusive level,
+    // moves to an exclusive level below, and is written back if dirty
+    template <int Level>
+    void evict(uint16_t pc, int block, bool dirty) {
+        Cache &cache = caches[Level];
+        int mem_addr = block * cache.blocksize;
+        if (cache.inclusion == INCLUSIVE)
+            dirty |= invalidate_above(Level, pc, mem_addr, cache.blocksize);
+        if (dirty) {
+            writebacks[Level]++;
+            if (log)
+                print_log_entry(CACHE_NAMES[Level], "WB", pc, mem_addr, block % cache.num_rows);
+        }
+        const int below = level_below(Level, Levels);
+        if (below < Levels && caches[below].inclusion == EXCLUSIVE)
+            victim<below>(pc, mem_addr, dirty);
+        else if (dirty)
+            write<below>(pc, mem_addr, cache.blocksize, false);
+    }
+
+    // a block evicted from the level above moves into exclusive level Level
+    template <int Level>
+    void victim(uint16_t pc, int mem_addr, bool dirty) {
+        if (Level == Levels)
+            return;
+        int line = cache_use(caches[Level], mem_addr);
+        if (line >= 0)
+            caches[Level].dirty[line] |= dirty;
+        else
+            place<Level>(pc, mem_addr, dirty);
+    }
+
+    // a level above Level has allocated the block holding mem_addr without reading it from
+    // below, so every inclusive level from Level down needs it too
+    template <int Level>
+    void include(uint16_t pc, int mem_addr) {
+        if (Level == Levels)
+            return;
+        Cache &cache = caches[Level];
+        if (cache.inclusion == INCLUSIVE && find_tag(cache, cache_row(cache, mem_addr),
+                mem_addr / cache.blocksize / cache.num_rows) < 0)
+            place<Level>(pc, mem_addr, false);
+        include<level_below(Level, Levels)>(pc, mem_addr);
+    }
+
+    // invalidates the blocks from mem_addr to mem_addr + words - 1 in every level above level;
+    // returns whether any were dirty
+    bool invalidate_above(int level, uint16_t pc, int mem_addr, int words) {
+        // instructions are never dirty
+        if (Fetch && level > 0) {
+            for (int addr = mem_addr; addr < mem_addr + words; addr += icache->blocksize)
+                fetch_invalidations += invalidate_fetched(addr);
+        }
+        bool dirty = false;
+        for (int above = 0; above < level; above++) {
+            Cache &cache = caches[above];
+            for (int addr = mem_addr; addr < mem_addr + words; addr += cache.blocksize) {
+                // a stream buffer's blocks are part of its level too
+                if (cache.prefetch == PREFETCH_STREAM) {
+                    for (int &block : cache.stream_blocks) {
+                        if (block == addr / cache.blocksize) {
+                            block = -1;
+                            useless_prefetches[above]++;
+                        }
+                    }
+                }
+                int row = cache_row(cache, addr);
+                int line = find_tag(cache, row, addr / cache.blocksize / cache.num_rows);
+                if (line < 0)
+                    continue;
+                dirty |= cache.dirty[line];
+                cache.valid[line] = 0;
+                cache.dirty[line] = 0;
+                invalidations[above]++;
+                if (log)
+                    print_log_entry(CACHE_NAMES[above], "INV", pc, addr, row);
+            }
+        }
+        return dirty;
+    }
+
+    // invalidates the block holding mem_addr in icache; returns whether it was there
+    bool invalidate_fetched(int mem_addr) {
+        int line = find_tag(*icache, cache_row(*icache, mem_addr), mem_addr / icache->blocksize / icache->num_rows);
+        if (line < 0)
+            return false;
+        icache->valid[line] = 0;
+        return true;
+    }
+
+    // fetches the instruction at pc through icache
+    void fetch(uint16_t pc) {
+        int mem_addr = pc & 8191;
+        accesses++;
+        if (cache_use(*icache, mem_addr) >= 0) {
+            fetch_hits[0]++;
+            return;
+        }
+        fetch_misses[0]++;
+        if (Levels > 1)
+            fetch_below(pc, mem_addr);
+        else {
+            memory_reads += icache->blocksize;
+            memory_blocks++;
+        }
+        // the block it evicts is clean, and no level below takes victims from icache
+        bool evicted_dirty;
+        cache_fill(*icache, mem_addr, false, evicted_dirty);
+        if (!pending.empty())
+            make_prefetches();
+    }
+
+    // reads the instruction at mem_addr from L2 for icache, unlogged and counted as a fetch
+    void fetch_below(uint16_t pc, int mem_addr) {
+        read_aside<level_below(0, Levels)>(pc, mem_addr, fetch_hits, fetch_misses);
+    }
+
+    // reads the block holding mem_addr from level Level, unlogged, with the hits and misses it
+    // makes in Level and below added to side_hits[] and side_misses[] (if they aren't nullptr)
+    // instead of the reads'; returns whether the block left an exclusive level dirty
+    template <int Level>
+    bool read_aside(uint16_t pc, int mem_addr, uint64_t side_hits[], uint64_t side_misses[]) {
+        uint64_t lw_hits[Levels], lw_misses[Levels];
+        copy(hits, hits + Levels, lw_hits);
+        copy(misses, misses + Levels, lw_misses);
+        bool logging = log;
+        bool was_aside = aside;
+        log = false;
+        aside = true;
+        bool dirty = read<Level>(pc, mem_addr);
+        log = logging;
+        aside = was_aside;
+        for (int level = Level; level < Levels; level++) {
+            if (side_hits != nullptr) {
+                side_hits[level] += hits[level] - lw_hits[level];
+                side_misses[level] += misses[level] - lw_misses[level];
+            }
+            hits[level] = lw_hits[level];
+            misses[level] = lw_misses[level];
+        }
+        return dirty;
+    }
+
+    // reads the block holding mem_addr from below level Level for its prefetcher, which doesn't
+    // wait for it; returns whether the block left an exclusive level dirty
+    template <int Level>
+    bool prefetch_read(uint16_t pc, int mem_addr) {
+        prefetches[Level]++;
+        uint64_t blocks = memory_blocks;
+        bool dirty = read_aside<level_below(Level, Levels)>(pc, mem_addr, nullptr, nullptr);
+        memory_blocks = blocks;
+        return dirty;
+    }
+
+    // makes the prefetches queued by an access, once it is done, so that none of them evicts the
+    // blocks it is bringing in; the reads they make below may queue more
+    E20_COLD void make_prefetches() {
+        for (size_t i = 0; i < pending.size(); i++)
+            make_prefetch<0>(pending[i]);
+        pending.clear();
+    }
+
+    template <int Level>
+    void make_prefetch(PendingPrefetch p) {
+        if (Level == Levels)
+            return;
+        if (p.level != Level)
+            make_prefetch<level_below(Level, Levels)>(p);
+        else if (p.into_cache)
+            prefetch<Level>(p.pc, p.mem_addr);
+        else
+            prefetch_read<Level>(p.pc, p.mem_addr);
+    }
+
+    // prefetches the block holding mem_addr into level Level, unless it's there already
+    template <int Level>
+    void prefetch(uint16_t pc, int mem_addr) {
+        Cache &cache = caches[Level];
+        if (find_tag(cache, cache_row(cache, mem_addr), mem_addr / cache.blocksize / cache.num_rows) >= 0)
+            return;
+        fill<Level>(pc, mem_addr, prefetch_read<Level>(pc, mem_addr), true);
+    }
+
+    // counts a read, or a sw, of the block holding mem_addr in level Level for summary
+    template <int Level>
+    E20_COLD void summarize(uint16_t pc, int mem_addr, bool hit, bool is_sw) {
+        CacheSummary &s = *summary;
+        int distance = s.shadows[Level].touch(mem_addr);
+        if (aside)
+            return;
+        if (Level == 0)
+            s.pc_accesses[pc & 8191]++;
+        if (is_sw)
+            (hit ? s.store_hits : s.store_misses)[Level]++;
+        if (hit)
+            return;
+        s.pc_misses[Level * MEM_SIZE + (pc & 8191)]++;
+        if (distance < 0)
+            s.compulsory[Level]++;
+        else if (distance >= s.blocks[Level])
+            s.capacity[Level]++;
+        else
+            s.conflict[Level]++;
+    }
+
+    // keeps track of the prefetched blocks of level Level, which has brought in the block holding
+    // mem_addr, prefetched or not, evicting the block number evicted (-1 if none)
+    template <int Level>
+    E20_COLD void filled(int mem_addr, int evicted, bool prefetched) {
+        Cache &cache = caches[Level];
+        // the new block is in the line the evicted one was in
+        int line = find_tag(cache, cache_row(cache, mem_addr), mem_addr / cache.blocksize / cache.num_rows);
+        if (evicted >= 0 && cache.prefetched[line])
+            useless_prefetches[Level]++;
+        if (evicted >= 0 && prefetched)
+            cache.evicted_by_prefetch[evicted] = 1;
+        cache.evicted_by_prefetch[mem_addr / cache.blocksize] = 0;
+        cache.prefetched[line] = prefetched;
+        cache.prefetch_time[line] = accesses;
+    }
+
+    // counts the first use of line of level Level, if it holds a prefetched block; returns whether it did
+    template <int Level>
+    bool first_use(int line) {
+        Cache &cache = caches[Level];
+        if (!cache.prefetched[line])
+            return false;
+        useful_prefetches[Level]++;
+        prefetch_lead[Level] += accesses - cache.prefetch_time[line];
+        cache.prefetched[line] = 0;
+        return true;
+    }
+
+    // trains level Level's prefetcher on a read of mem_addr, which hit in line, or missed,
+    // and queues the prefetches it asks for
+    template <int Level>
+    E20_COLD void train(uint16_t pc, int mem_addr, int line, bool missed) {
+        Cache &cache = caches[Level];
+        bool used = !missed && first_use<Level>(line);
+        int block = mem_addr / cache.blocksize;
+        int blocks = blocks_in_memory(cache.blocksize);
+        switch (cache.prefetch) {
+        case PREFETCH_NEXTLINE:
+            if (missed || used) {
+                for (int i = 0; i < cache.degree; i++)
+                    pending.push_back({Level, pc, (block + cache.distance + i) % blocks * cache.blocksize, true});
+            }
+            break;
+        case PREFETCH_STRIDE: {
+            StrideEntry &entry = cache.strides[pc % STRIDE_ENTRIES];
+            if (entry.pc != pc) {
+                entry = {pc, mem_addr, 0};
+                break;
+            }
+            int stride = mem_addr - entry.last;
+            bool steady = stride != 0 && stride == entry.stride;
+            entry.last = mem_addr;
+            entry.stride = stride;
+            if (!steady)
+                break;
+            int step = abs(stride) >= cache.blocksize ? stride : stride > 0 ? cache.blocksize : -cache.blocksize;
+            for (int i = 0; i < cache.degree; i++)
+                pending.push_back({Level, pc, (mem_addr + step * (cache.distance + i)) & 8191, true});
+            break;
+        }
+        case PREFETCH_STREAM:
+            if (missed) {
+                // the oldest stream buffer starts over after this block
+                int first = cache.stream_next * cache.degree;
+                for (int i = 0; i < cache.degree; i++) {
+                    useless_prefetches[Level] += cache.stream_blocks[first + i] >= 0;
+                    cache.stream_blocks[first + i] = (block + cache.distance + i) % blocks;
+                    cache.stream_time[first + i] = accesses;
+                    pending.push_back({Level, pc, cache.stream_blocks[first + i] * cache.blocksize, false});
+                }
+                cache.stream_last[cache.stream_next] = cache.stream_blocks[first + cache.degree - 1];
+                cache.stream_next = (cache.stream_next + 1) % STREAM_BUFFERS;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // whether the block holding mem_addr is in one of cache's stream buffers
+    static bool in_stream(const Cache &cache, int mem_addr) {
+        return find(cache.stream_blocks.begin(), cache.stream_blocks.end(), mem_addr / cache.blocksize) !=
+            cache.stream_blocks.end();
+    }
+
+    // moves the block holding mem_addr from the stream buffer of level Level that has it into
+    // the cache, dropping the blocks ahead of it, and queues as many after the buffer's last
+    template <int Level>
+    E20_COLD void take_streamed(uint16_t pc, int mem_addr) {
+        Cache &cache = caches[Level];
+        int found = find(cache.stream_blocks.begin(), cache.stream_blocks.end(), mem_addr / cache.blocksize) -
+            cache.stream_blocks.begin();
+        int buffer = found / cache.degree;
+        int *blocks = &cache.stream_blocks[buffer * cache.degree];
+        uint64_t *times = &cache.stream_time[buffer * cache.degree];
+        int taken = found - buffer * cache.degree + 1;
+        useful_prefetches[Level]++;
+        prefetch_lead[Level] += accesses - times[taken - 1];
+        for (int i = 0; i < taken - 1; i++)
+            useless_prefetches[Level] += blocks[i] >= 0;
+        copy(blocks + taken, blocks + cache.degree, blocks);
+        copy(times + taken, times + cache.degree, times);
+        int &next = cache.stream_last[buffer];
+        for (int i = cache.degree - taken; i < cache.degree; i++) {
+            next = (next + 1) % blocks_in_memory(cache.blocksize);
+            blocks[i] = next;
+            times[i] = accesses;
+            pending.push_back({Level, pc, next * cache.blocksize, false});
+        }
+        fill<Level>(pc, mem_addr, false);
+    }
+
+    void on_instr(uint16_t pc, uint16_t) {
+        if (Fetch)
+            fetch(pc);
+    }
+
+    void on_lw(uint16_t pc, int mem_addr, uint16_t) {
+        if (next_use != nullptr)
+            caches[0].next_use = next_use[accesses];
+        accesses++;
+        read<0>(pc, mem_addr);
+        if (!pending.empty())
+            make_prefetches();
+    }
+
+    void on_sw(uint16_t pc, int mem_addr, uint16_t) {
+        if (next_use != nullptr)
+            caches[0].next_use = next_use[accesses];
+        accesses++;
+        sws++;
+        write<0>(pc, mem_addr, 1, true);
+        // a program that writes over its own code fetches the new instructions
+        if (Fetch)
+            fetch_invalidations += invalidate_fetched(mem_addr);
+        if (!pending.empty())
+            make_prefetches();
+    }
+};
+
+/*
+    StackDistanceObserver
+    computes the LRU hits of every cache with blocksize and number of rows powers of two,
+        and at most as many rows as memory has blocks, in one run (see NoObserver)
+        a sw uses its block like a lw does, without being counted
+    members:
+        stacks = one LruStacks per geometry, by blocksize then rows
+        lw, sw = number of each seen
+ */
+struct StackDistanceObserver : NoObserver {
+    vector<LruStacks> stacks;
+    uint64_t lw;
+    uint64_t sw;
+
+    StackDistanceObserver() : lw(0), sw(0) {
+        for (int blocksize = 1; blocksize <= 64; blocksize *= 2) {
+            for (int num_rows = 1; num_rows <= (int)MEM_SIZE / blocksize; num_rows *= 2)
+                stacks.emplace_back(blocksize, num_rows);
+        }
+    }
+
+    void on_lw(uint16_t, int mem_addr, uint16_t) {
+        lw++;
+        for (LruStacks &s : stacks)
+            s.use(mem_addr, true);
+    }
+
+    void on_sw(uint16_t, int mem_addr, uint16_t) {
+        sw++;
+        for (LruStacks &s : stacks)
+            s.use(mem_addr, false);
+    }
+};
+
+/*
+    print_stack_distances(sd)
+    prints the lw hit rate against cache size for every blocksize and associativity:
+        fully associative (one row, any number of blocks), then each associativity simcache
+        accepts, over every power of two number of rows up to a cache the size of memory
+    parameters:
+        sd = analysis of a finished run
+ */
+void print_stack_distances(const StackDistanceObserver &sd) {
+    cout << "Stack distances of " << sd.lw << " lw and " << sd.sw << " sw" << endl;
+    for (int blocksize = 1; blocksize <= 64; blocksize *= 2) {
+        int blocks = MEM_SIZE / blocksize;
+        // fully associative, then each associativity; assoc 0 stands for fully associative
+        for (int assoc : {0, 1, 2, 4, 8, 16}) {
+            cout << "Blocksize " << blocksize << ", associativity " <<
+                (assoc == 0 ? string("full") : to_string(assoc)) << endl;
+            cout << setw(8) << "size" << setw(8) << "rows" << setw(12) << "hits" << setw(10) << "hit rate" << endl;
+            for (const LruStacks &s : sd.stacks) {
+                if (s.blocksize != blocksize)
+                    continue;
+                if (assoc == 0 ? s.num_rows != 1 : s.num_rows * assoc > blocks)
+                    continue;
+                for (int ways = assoc == 0 ? 1 : assoc; ways <= (assoc == 0 ? blocks : assoc); ways *= 2) {
+                    uint64_t hits = s.hits(ways);
+                    cout << setw(8) << ways * s.num_rows * blocksize << setw(8) << s.num_rows << setw(12) << hits <<
+                        setw(9) << fixed << setprecision(2) << (sd.lw > 0 ? 100.0 * hits / sd.lw : 0.0) << "%" << endl;
+                }
+            }
+        }
+    }
+}
+
+/*
+    save_caches(caches)
+    packs the configuration and contents of the simulated caches into bytes for a checkpoint
+        as 32 bit words: number of caches, then for each cache (L1 first, the instruction
+        cache last) its blocksize, rows
+        and associativity, then for each row the number of tags and the tags, lowest age first
+        (the LRU, or the first filled), with SAVED_DIRTY set on the dirty ones; other
+        replacement policies only keep the contents
+    parameters:
+        caches = caches being simulated
+ */
+uint32_t const static SAVED_DIRTY = 1U << 31;
+
+template <int Levels, bool Fetch>
+vector<uint8_t> save_caches(const CacheObserver<Levels, Fetch> &caches) {
+    vector<uint32_t> words;
+    words.push_back(Levels + Fetch);
+    for (int c = 0; c < Levels + Fetch; c++) {
+        const Cache &cache = c < Levels ? caches.caches[c] : *caches.icache;
+        words.push_back(cache.blocksize);
+        words.push_back(cache.num_rows);
+        words.push_back(cache.assoc);
+        for (int row = 0; row < cache.num_rows; row++) {
+            // the row's tags, oldest use first
+            vector<pair<uint64_t, uint32_t>> lines;
+            for (int line = row * cache.assoc; line < (row + 1) * cache.assoc; line++) {
+                if (cache.valid[line])
+                    lines.push_back({cache.age[line], cache.tags[line] | (cache.dirty[line] ? SAVED_DIRTY : 0)});
+            }
+            sort(lines.begin(), lines.end());
+            words.push_back(lines.size());
+            for (const pair<uint64_t, uint32_t> &line : lines)
+                words.push_back(line.second);
+        }
+    }
+    vector<uint8_t> bytes(words.size() * sizeof(uint32_t));
+    memcpy(bytes.data(), words.data(), bytes.size());
+    return bytes;
+}
+
+/*
+    load_caches(bytes, caches)
+    refills the simulated caches from bytes written by save_caches
+    returns false if the saved caches aren't configured like caches
+    parameters:
+        bytes = cache state read from a checkpoint
+        caches = caches being simulated
+ */
+template <int Levels, bool Fetch>
+bool load_caches(const vector<uint8_t> &bytes, CacheObserver<Levels, Fetch> &caches) {
+    vector<uint32_t> words(bytes.size() / sizeof(uint32_t));
+    memcpy(words.data(), bytes.data(), words.size() * sizeof(uint32_t));
+    size_t pos = 0;
+    if (words.size() == 0 || words[pos++] != (uint32_t)(Levels + Fetch))
+        return false;
+    for (int c = 0; c < Levels + Fetch; c++) {
+        Cache &cache = c < Levels ? caches.caches[c] : *caches.icache;
+        if (pos + 3 > words.size() || words[pos] != (uint32_t)cache.blocksize ||
+                words[pos + 1] != (uint32_t)cache.num_rows || words[pos + 2] != (uint32_t)cache.assoc)
+            return false;
+        pos += 3;
+        for (int row = 0; row < cache.num_rows; row++) {
+            if (pos >= words.size() || words[pos] > (uint32_t)cache.assoc || pos + 1 + words[pos] > words.size())
+                return false;
+            // refilled oldest first, so the ages come out in the saved order
+            with_replacement(cache, [&](auto policy) {
+                for (uint32_t i = 0; i < words[pos]; i++) {
+                    uint32_t word = words[pos + 1 + i];
+                    bool evicted_dirty;
+                    add_tag<decltype(policy)>(cache, row, word & ~SAVED_DIRTY, (word & SAVED_DIRTY) != 0, evicted_dirty);
+                }
+            });
+            pos += 1 + words[pos];
+        }
+    }
+    return pos == words.size();
+}
+
+/*
+    simulate(m, caches, executed, saved, checkpoint, every, trace, stats)
+    runs m to completion through the simulated caches, optionally saving checkpoints
+        on the threaded core, specialized for the cache levels and the features that are on
+    returns the exit status for main
+    parameters:
+        m = machine to run
+        caches = caches being simulated
+        executed = instructions executed before m was restored, 0 for a fresh run
+        saved = cache state from the restored checkpoint, empty for cold caches
+        checkpoint = checkpoints are saved to checkpoint.n, or none if nullptr
+        every = instructions between checkpoints, 0 for SIGUSR1 only
+        trace = tracer, or nullptr
+        stats = statistics collector, or nullptr; printing it is up to the caller
+ */
+template <int Levels, bool Fetch>
+int simulate(Machine &m, CacheObserver<Levels, Fetch> &caches, uint64_t executed, const vector<uint8_t> &saved,
+        const char *checkpoint, uint64_t every, TextTrace *trace, ExecStats *stats) {
+    if (saved.size() > 0 && !load_caches(saved, caches)) {
+        cerr << "Checkpoint holds caches configured differently from --cache" << endl;
+        return 1;
+    }
+    with_policies(caches, trace, nullptr, stats, [&](auto &obs) {
+        if (checkpoint == nullptr) {
+            run(m, RUN_UNTIL_HALT, obs);
+            return;
+        }
+        install_checkpoint_signal();
+        run_with_checkpoints(m, executed, every, obs, [&]() {
+            string name = string(checkpoint) + "." + to_string(executed);
+            string error;
+            if (!write_checkpoint(name, m, executed, save_caches(caches), error)) {
+                cerr << error << endl;
+                exit(1);
+            }
+        });
+    });
+    return 0;
+}
+
+/*
+    AccessRecorder
+    keeps every lw and sw a run makes, in order, so they can be replayed through many caches
+        accesses[] = address of each access, with SWEEP_SW set for a sw, or SWEEP_FETCH
+            for an instruction fetch
+        pcs[] = pc of each access
+        instructions = number of instructions, when replaying a trace (a run skips counted loops)
+ */
+uint16_t const static SWEEP_SW = 1 << 15;
+uint16_t const static SWEEP_FETCH = 1 << 14;
+
+struct AccessRecorder : NoObserver {
+    vector<uint16_t> accesses;
+    vector<uint16_t> pcs;
+    uint64_t instructions = 0;
+
+    void on_instr(uint16_t, uint16_t) {
+        instructions++;
+    }
+
+    void on_lw(uint16_t pc, int mem_addr, uint16_t) {
+        accesses.push_back(mem_addr);
+        pcs.push_back(pc);
+    }
+
+    void on_sw(uint16_t pc, int mem_addr, uint16_t) {
+        accesses.push_back(mem_addr | SWEEP_SW);
+        pcs.push_back(pc);
+    }
+};
 
 /*
-    Prints out the correctly-formatted configuration of a cache.
+    FetchRecorder
+    AccessRecorder that also keeps every instruction fetch, for an instruction cache
+ */
+struct FetchRecorder : AccessRecorder {
+    static const bool sees_every_instruction = true;
 
-    @param cache_name The name of the cache. "L1" or "L2"
+    void on_instr(uint16_t pc, uint16_t) {
+        instructions++;
+        accesses.push_back((pc & 8191) | SWEEP_FETCH);
+        pcs.push_back(pc);
+    }
+};
 
-    @param size The total size of the cache, measured in memory cells.
-        Excludes metadata
+/*
+    read_accesses(trace_name, recorder, error)
+    reads every lw and sw of a trace recorded by sim --trace, and the fetches if recorder
+        is a FetchRecorder, into recorder
+    returns false, with a description in error, if the trace can't be read
+ */
+template <typename Recorder>
+bool read_accesses(const char *trace_name, Recorder &recorder, string &error) {
+    TraceReader reader;
+    if (!reader.open(trace_name, error))
+        return false;
+    if (!replay_trace(reader, recorder)) {
+        error = reader.error;
+        return false;
+    }
+    return true;
+}
 
-    @param assoc The associativity of the cache. One of [1,2,4,8,16]
+// next_uses entry of an access whose block isn't used again
+uint64_t const static NEVER_USED = numeric_limits<uint64_t>::max();
 
-    @param blocksize The blocksize of the cache. One of [1,2,4,8,16,32,64])
+/*
+    next_uses(accesses, blocksize)
+    for Belady's OPT: returns, for each recorded lw and sw, the index of the next lw or sw
+        of the same block, or NEVER_USED
+    parameters:
+        accesses = lw and sw recorded by AccessRecorder
+        blocksize = blocksize of the cache
+ */
+vector<uint64_t> next_uses(const vector<uint16_t> &accesses, int blocksize) {
+    vector<uint64_t> next(accesses.size());
+    vector<uint64_t> upcoming(MEM_SIZE / blocksize + 1, NEVER_USED);
+    for (size_t i = accesses.size(); i-- > 0;) {
+        // fetches go to the instruction cache
+        if (accesses[i] & SWEEP_FETCH)
+            continue;
+        int block = (accesses[i] & 8191) / blocksize;
+        next[i] = upcoming[block];
+        upcoming[block] = i;
+    }
+    return next;
+}
 
-    @param num_rows The number of rows in the given cache.
-*/
-void print_cache_config(const string &cache_name, int size, int assoc, int blocksize, int num_rows) {
-    cout << "Cache " << cache_name << " has size " << size <<
-        ", associativity " << assoc << ", blocksize " << blocksize <<
-        ", rows " << num_rows << endl;
+/*
+    replay(recorder, caches)
+    runs recorded accesses through the simulated caches, without simulating the program
+    parameters:
+        recorder = lw and sw to replay
+        caches = caches being simulated
+ */
+template <int Levels, bool Fetch>
+void replay(const AccessRecorder &recorder, CacheObserver<Levels, Fetch> &caches) {
+    vector<uint64_t> next;
+    if (caches.caches[0].replacement == REPL_OPT) {
+        next = next_uses(recorder.accesses, caches.caches[0].blocksize);
+        caches.next_use = next.data();
+    }
+    for (size_t i = 0; i < recorder.accesses.size(); i++) {
+        uint16_t access = recorder.accesses[i];
+        if (access & SWEEP_FETCH)
+            caches.on_instr(recorder.pcs[i], 0);
+        else if (access & SWEEP_SW)
+            caches.on_sw(recorder.pcs[i], access & 8191, 0);
+        else
+            caches.on_lw(recorder.pcs[i], access, 0);
+    }
+    caches.next_use = nullptr;
 }
 
 /*
-    Prints out a correctly-formatted log entry.
+    with_levels(levels, caches, icache, log, f)
+    calls f(observer) with the CacheObserver for levels levels of cache, and an instruction
+        cache if icache isn't nullptr
+    parameters:
+        levels = number of levels, 1 to MAX_LEVELS
+        caches = the caches, L1 first
+        icache = the L1 instruction cache, or nullptr
+        log = whether to print a log entry for every access
+        f = callable taking the observer, typically a generic lambda
+ */
+template <bool Fetch, typename F>
+void with_fetch_levels(int levels, Cache *caches, Cache *icache, bool log, F f) {
+    switch (levels) {
+    case 1: {
+        CacheObserver<1, Fetch> observer(caches, log, icache);
+        f(observer);
+        break;
+    }
+    case 2: {
+        CacheObserver<2, Fetch> observer(caches, log, icache);
+        f(observer);
+        break;
+    }
+    case 3: {
+        CacheObserver<3, Fetch> observer(caches, log, icache);
+        f(observer);
+        break;
+    }
+    default: {
+        CacheObserver<MAX_LEVELS, Fetch> observer(caches, log, icache);
+        f(observer);
+        break;
+    }
+    }
+}
 
-    @param cache_name The name of the cache where the event
-        occurred. "L1" or "L2"
+template <typename F>
+void with_levels(int levels, Cache *caches, Cache *icache, bool log, F f) {
+    if (icache != nullptr)
+        with_fetch_levels<true>(levels, caches, icache, log, f);
+    else
+        with_fetch_levels<false>(levels, caches, icache, log, f);
+}
 
-    @param status The kind of cache event. "SW", "HIT", or
-        "MISS"
+/*
+    SweepPoint
+    one cache configuration of a sweep, and its results
+        levels = number of caches, 1 to MAX_LEVELS
+        config[] = configuration of each level, L1 first
+        hits[], misses[] = reads that hit and missed in each level
+        sws = number of sw
+        writebacks[] = dirty blocks evicted from each level
+        invalidations[] = blocks of each level invalidated by an inclusive level below
+        memory_reads, memory_writes = words read from and written to memory
+        memory_blocks = blocks read from memory
+        fetch_hits[], fetch_misses[] = with an instruction cache, fetches that hit and
+            missed in it, then in each level below L1
+        prefetches[], useful_prefetches[], useless_prefetches[], prefetch_lead[], pollution[] =
+            what each level's prefetcher did (see CacheObserver)
+ */
+struct SweepPoint {
+    int levels;
+    LevelConfig config[MAX_LEVELS];
+    uint64_t hits[MAX_LEVELS];
+    uint64_t misses[MAX_LEVELS];
+    uint64_t sws;
+    uint64_t writebacks[MAX_LEVELS];
+    uint64_t invalidations[MAX_LEVELS];
+    uint64_t memory_reads;
+    uint64_t memory_writes;
+    uint64_t memory_blocks;
+    uint64_t fetch_hits[MAX_LEVELS];
+    uint64_t fetch_misses[MAX_LEVELS];
+    uint64_t prefetches[MAX_LEVELS];
+    uint64_t useful_prefetches[MAX_LEVELS];
+    uint64_t useless_prefetches[MAX_LEVELS];
+    uint64_t prefetch_lead[MAX_LEVELS];
+    uint64_t pollution[MAX_LEVELS];
+};
 
-    @param pc The program counter of the memory
-        access instruction
+/*
+    parse_sweep_values(spec, lo, hi, values)
+    parses a comma separated list of numbers and ranges A-B, which stand for
+        the powers of two from A to B, into values
+    returns false if spec is malformed or a value is outside lo to hi
+    parameters:
+        spec = list to parse
+        lo, hi = range every value must be in
+        values = receives the values
+ */
+bool parse_sweep_values(const string &spec, int lo, int hi, vector<int> &values) {
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(start, end - start);
+        size_t dash = item.find('-');
+        string first = item.substr(0, dash);
+        string last = dash == string::npos ? first : item.substr(dash + 1);
+        if (first.empty() || last.empty() || first.size() > 9 || last.size() > 9 ||
+                (first + last).find_first_not_of("0123456789") != string::npos)
+            return false;
+        int a = stoi(first);
+        int b = stoi(last);
+        if (a < lo || b > hi || a > b)
+            return false;
+        if (dash == string::npos)
+            values.push_back(a);
+        else {
+            // a range is the powers of two in it
+            for (int v = 1; v <= b; v *= 2) {
+                if (v >= a)
+                    values.push_back(v);
+            }
+        }
+        start = end + 1;
+    }
+    return values.size() > 0;
+}
 
-    @param addr The memory address being accessed.
+/*
+    parse_sweep(spec, points)
+    parses a sweep specification, SIZES:ASSOCS:BLOCKSIZES for one cache,
+        with /SIZES:ASSOCS:BLOCKSIZES appended for each further level, into every valid
+        combination (the size must be a multiple of associativity times blocksize), with
+        the default policies
+    returns false if spec is malformed
+    parameters:
+        spec = the specification
+        points = receives the configurations
+ */
+bool parse_sweep(const string &spec, vector<SweepPoint> &points) {
+    // values[level][0..2] = sizes, associativities, blocksizes
+    vector<int> values[MAX_LEVELS][3];
+    int levels = 0;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find('/', start);
+        if (end == string::npos)
+            end = spec.size();
+        if (levels == MAX_LEVELS)
+            return false;
+        string level = spec.substr(start, end - start);
+        size_t c1 = level.find(':');
+        size_t c2 = c1 == string::npos ? c1 : level.find(':', c1 + 1);
+        if (c2 == string::npos || level.find(':', c2 + 1) != string::npos)
+            return false;
+        if (!parse_sweep_values(level.substr(0, c1), 1, MEM_SIZE * 64, values[levels][0]) ||
+                !parse_sweep_values(level.substr(c1 + 1, c2 - c1 - 1), 1, 16, values[levels][1]) ||
+                !parse_sweep_values(level.substr(c2 + 1), 1, 64, values[levels][2]))
+            return false;
+        levels++;
+        start = end + 1;
+    }
+    // every combination of the levels so far, adding one level at a time
+    vector<SweepPoint> partial(1, SweepPoint());
+    partial[0].levels = levels;
+    for (int level = 0; level < levels; level++) {
+        vector<SweepPoint> next;
+        for (const SweepPoint &point : partial)
+            for (int size : values[level][0])
+                for (int assoc : values[level][1])
+                    for (int blocksize : values[level][2])
+                        if (size % (assoc * blocksize) == 0) {
+                            next.push_back(point);
+                            next.back().config[level] = {size, assoc, blocksize, REPL_LRU, WRITE_THROUGH, NINE,
+                                {PREFETCH_NONE, 1, 1}};
+                        }
+        partial.swap(next);
+    }
+    points.insert(points.end(), partial.begin(), partial.end());
+    return true;
+}
 
-    @param row The cache row or set number where the data
-        is stored.
-*/
-void print_log_entry(const string &cache_name, const string &status, int pc, int addr, int row) {
-    cout << left << setw(8) << cache_name + " " + status <<  right <<
-        " pc:" << setw(5) << pc <<
-        "\taddr:" << setw(5) << addr <<
-        "\trow:" << setw(4) << row << endl;
+/*
+    sweep_point(recorder, point, icache, seed)
+    runs the recorded accesses through the caches configured by point, counting hits, misses and traffic
+        doesn't print anything, so it is safe to run several at once
+    parameters:
+        recorder = lw and sw recorded by AccessRecorder, with the fetches if icache isn't nullptr
+        point = configuration, receiving its results
+        icache = configuration of the L1 instruction cache, or nullptr for none
+        seed = seed of the caches' random number generators
+ */
+void sweep_point(const AccessRecorder &recorder, SweepPoint &point, const LevelConfig *icache, uint64_t seed) {
+    Cache caches[MAX_LEVELS];
+    for (int level = 0; level < point.levels; level++)
+        caches[level] = create_cache(point.config[level], seed + level);
+    Cache fetch_cache;
+    if (icache != nullptr)
+        fetch_cache = create_cache(*icache, seed + MAX_LEVELS);
+    with_levels(point.levels, caches, icache == nullptr ? nullptr : &fetch_cache, false, [&](auto &observer) {
+        replay(recorder, observer);
+        for (int level = 0; level < point.levels; level++) {
+            point.hits[level] = observer.hits[level];
+            point.misses[level] = observer.misses[level];
+            point.writebacks[level] = observer.writebacks[level];
+            point.invalidations[level] = observer.invalidations[level];
+            point.fetch_hits[level] = observer.fetch_hits[level];
+            point.fetch_misses[level] = observer.fetch_misses[level];
+            point.prefetches[level] = observer.prefetches[level];
+            point.useful_prefetches[level] = observer.useful_prefetches[level];
+            point.useless_prefetches[level] = observer.useless_prefetches[level];
+            point.prefetch_lead[level] = observer.prefetch_lead[level];
+            point.pollution[level] = observer.pollution[level];
+        }
+        point.sws = observer.sws;
+        point.memory_reads = observer.memory_reads;
+        point.memory_blocks = observer.memory_blocks;
+        point.memory_writes = observer.memory_writes;
+    });
 }
 
 /*
-    Loads an E20 machine code file into the list
-    provided by mem. We assume that mem is
-    large enough to hold the values in the machine
-    code file.
+    memory_cycles(counts, levels, latency)
+    returns the cycles a run spends on memory accesses: every lw, sw and instruction fetch
+        takes L1's latency, and every read reaching a level below, or memory, that level's
+        latency too; writes below L1 and writebacks go through a write buffer, without stalling
+    parameters:
+        counts = CacheObserver of a finished run, or SweepPoint
+        levels = number of levels of cache
+        latency = hit latency of each level, L1 (and L1I) first, then memory's latency
+ */
+template <typename Counts>
+uint64_t memory_cycles(const Counts &counts, int levels, const vector<int> &latency) {
+    uint64_t cycles = (counts.hits[0] + counts.misses[0] + counts.sws + counts.fetch_hits[0] + counts.fetch_misses[0]) *
+        latency[0];
+    for (int level = 1; level < levels; level++)
+        cycles += (counts.hits[level] + counts.misses[level] + counts.fetch_hits[level] + counts.fetch_misses[level]) *
+            latency[level];
+    return cycles + counts.memory_blocks * latency[levels];
+}
 
-    @param f Open file to read from
-    @param mem Array represetnting memory into which to read program
-*/
-void load_machine_code(ifstream &f, uint16_t mem[]) {
-    regex machine_code_re("^ram\\[(\\d+)\\] = 16'b(\\d+);.*$");
-    size_t expectedaddr = 0;
-    string line;
-    while (getline(f, line)) {
-        smatch sm;
-        if (!regex_match(line, sm, machine_code_re)) {
-            cerr << "Can't parse line: " << line << endl;
-            exit(1);
+/*
+    access_times(counts, levels, latency, amat, fetch_amat)
+    works out the average memory access time of the reads of each level, from its latency,
+        its miss rate and the average access time of the level below (memory's is its latency)
+    parameters:
+        counts = CacheObserver of a finished run, or SweepPoint
+        levels = number of levels of cache
+        latency = hit latency of each level, L1 (and L1I) first, then memory's latency
+        amat = receives the average access time of lw in L1, then of all reads in each level below
+        fetch_amat = receives the average access time of fetches in L1I
+ */
+template <typename Counts>
+void access_times(const Counts &counts, int levels, const vector<int> &latency, double amat[], double &fetch_amat) {
+    // the average access time of the level below each level, memory's for the last
+    double below = latency[levels];
+    for (int level = levels - 1; level > 0; level--) {
+        uint64_t misses = counts.misses[level] + counts.fetch_misses[level];
+        uint64_t reads = counts.hits[level] + counts.fetch_hits[level] + misses;
+        amat[level] = latency[level] + (reads > 0 ? (double)misses / reads : 0.0) * below;
+        below = amat[level];
+    }
+    uint64_t lws = counts.hits[0] + counts.misses[0];
+    uint64_t fetches = counts.fetch_hits[0] + counts.fetch_misses[0];
+    amat[0] = latency[0] + (lws > 0 ? (double)counts.misses[0] / lws : 0.0) * below;
+    fetch_amat = latency[0] + (fetches > 0 ? (double)counts.fetch_misses[0] / fetches : 0.0) * below;
+}
+
+/*
+    prefetch_rates(counts, level, accuracy, coverage, lead)
+    works out how well a level's prefetcher did
+    parameters:
+        counts = CacheObserver of a finished run, or SweepPoint
+        level = the level
+        accuracy = receives the share of its prefetches that were useful
+        coverage = receives the share of the misses the level would have had without it that
+            it turned into hits: useful prefetches over useful prefetches and misses
+        lead = receives the average number of accesses from a useful prefetch to its first use
+ */
+template <typename Counts>
+void prefetch_rates(const Counts &counts, int level, double &accuracy, double &coverage, double &lead) {
+    uint64_t useful = counts.useful_prefetches[level];
+    // below L1 the fetches read the level too
+    uint64_t misses = counts.misses[level] + (level > 0 ? counts.fetch_misses[level] : 0);
+    accuracy = counts.prefetches[level] > 0 ? (double)useful / counts.prefetches[level] : 0.0;
+    coverage = useful + misses > 0 ? (double)useful / (useful + misses) : 0.0;
+    lead = useful > 0 ? (double)counts.prefetch_lead[level] / useful : 0.0;
+}
+
+/*
+    print_sweep(points, traffic, fetch, latency, base_cycles, instructions)
+    prints the results of a sweep as CSV, one line per configuration, with
+        size, associativity, blocksize, rows, hits, misses and hit rate for each level
+        (the reads reaching L2 are the ones that missed in L1), then the number of sw,
+        then if fetch is true the fetch hits, misses and hit rate of the instruction cache
+        and the fetch hits and misses of each level below L1, then if traffic is true the
+        writebacks from and invalidations in each level and the words read from and
+        written to memory, then if prefetch is true what each level's prefetcher did (see
+        print_prefetches), then if latency isn't empty the cycles, CPI and average memory
+        access time of each level (see print_timing)
+    parameters:
+        points = swept configurations
+        traffic = whether to print the write traffic
+        fetch = whether the points have an instruction cache
+        prefetch = whether the points have prefetchers
+        latency = hit latency of each level, then memory's, or empty for no timing
+        base_cycles = cycles of the instructions executed, without their memory accesses
+        instructions = instructions executed
+ */
+void print_sweep(const vector<SweepPoint> &points, bool traffic, bool fetch, bool prefetch,
+        const vector<int> &latency, uint64_t base_cycles, uint64_t instructions) {
+    int levels = points.empty() ? 1 : points[0].levels;
+    for (int level = 0; level < levels; level++) {
+        string name = CACHE_NAMES[level];
+        cout << name << " size," << name << " assoc," << name << " blocksize," << name << " rows," <<
+            name << " hits," << name << " misses," << name << " hit rate,";
+    }
+    cout << "sw";
+    if (fetch) {
+        cout << ",L1I hits,L1I misses,L1I hit rate";
+        for (int level = 1; level < levels; level++)
+            cout << "," << CACHE_NAMES[level] << " fetch hits," << CACHE_NAMES[level] << " fetch misses";
+    }
+    if (traffic) {
+        for (int level = 0; level < levels; level++)
+            cout << "," << CACHE_NAMES[level] << " writebacks," << CACHE_NAMES[level] << " invalidations";
+        cout << ",memory reads,memory writes";
+    }
+    if (prefetch) {
+        for (int level = 0; level < levels; level++) {
+            string name = CACHE_NAMES[level];
+            cout << "," << name << " prefetches," << name << " useful prefetches," << name << " useless prefetches," <<
+                name << " prefetch accuracy," << name << " prefetch coverage," << name << " prefetch lead," <<
+                name << " pollution";
         }
-        size_t addr = stoi(sm[1], nullptr, 10);
-        unsigned instr = stoi(sm[2], nullptr, 2);
-        if (addr != expectedaddr) {
-            cerr << "Memory addresses encountered out of sequence: " << addr << endl;
-            exit(1);
+    }
+    if (!latency.empty()) {
+        cout << ",cycles,CPI";
+        for (int level = 0; level < levels; level++)
+            cout << "," << CACHE_NAMES[level] << " AMAT" << (fetch && level == 0 ? ",L1I AMAT" : "");
+    }
+    cout << endl;
+    for (const SweepPoint &point : points) {
+        for (int level = 0; level < levels; level++) {
+            const LevelConfig &c = point.config[level];
+            uint64_t lw = point.hits[level] + point.misses[level];
+            cout << c.size << "," << c.assoc << "," << c.blocksize << "," << c.size / c.assoc / c.blocksize << "," <<
+                point.hits[level] << "," << point.misses[level] << "," <<
+                fixed << setprecision(4) << (lw > 0 ? (double)point.hits[level] / lw : 0.0) << ",";
+        }
+        cout << point.sws;
+        if (fetch) {
+            uint64_t fetches = point.fetch_hits[0] + point.fetch_misses[0];
+            cout << "," << point.fetch_hits[0] << "," << point.fetch_misses[0] << "," <<
+                fixed << setprecision(4) << (fetches > 0 ? (double)point.fetch_hits[0] / fetches : 0.0);
+            for (int level = 1; level < levels; level++)
+                cout << "," << point.fetch_hits[level] << "," << point.fetch_misses[level];
+        }
+        if (traffic) {
+            for (int level = 0; level < levels; level++)
+                cout << "," << point.writebacks[level] << "," << point.invalidations[level];
+            cout << "," << point.memory_reads << "," << point.memory_writes;
         }
-        if (addr >= MEM_SIZE) {
-            cerr << "Program too big for memory" << endl;
-            exit(1);
+        if (prefetch) {
+            for (int level = 0; level < levels; level++) {
+                double accuracy, coverage, lead;
+                prefetch_rates(point, level, accuracy, coverage, lead);
+                cout << "," << point.prefetches[level] << "," << point.useful_prefetches[level] << "," <<
+                    point.useless_prefetches[level] << "," << accuracy << "," << coverage << "," << lead << "," <<
+                    point.pollution[level];
+            }
+        }
+        if (!latency.empty()) {
+            uint64_t cycles = base_cycles + memory_cycles(point, levels, latency);
+            double amat[MAX_LEVELS];
+            double fetch_amat;
+            access_times(point, levels, latency, amat, fetch_amat);
+            cout << "," << cycles << "," << (instructions > 0 ? (double)cycles / instructions : 0.0);
+            for (int level = 0; level < levels; level++) {
+                cout << "," << amat[level];
+                if (fetch && level == 0)
+                    cout << "," << fetch_amat;
+            }
         }
-        expectedaddr ++;
-        mem[addr] = instr;
+        cout << endl;
     }
 }
 
 /*
-    ALU(regs[], val1, val2, dst, op)
-    performs an ALU operation (which operation depends on op) on val1 and val2
-        stores the result in regs[dst]
+    print_traffic(caches)
+    prints the writebacks from and invalidations in each level, and the words read from
+        and written to memory
     parameters:
-        regs[] = an array containing the values of regs 1-7, passed by reference
-        val1 = first operand to the ALU
-        val2 = second operand to the ALU
-        op = opcode determining which ALU operation should be performed
+        caches = caches of a finished run
  */
-void ALU(uint16_t regs[], int val1, int val2, int dst, const string& op) {
-    if ((op == "add") | (op == "addi")) {
-        int sum = val1 + val2;
-        regs[dst] = sum;
-    }
-    else if (op == "sub") {
-        int diff = val1 - val2;
-        regs[dst] = diff;
-    }
+template <int Levels, bool Fetch>
+void print_traffic(const CacheObserver<Levels, Fetch> &caches) {
+    for (int level = 0; level < Levels; level++)
+        cout << CACHE_NAMES[level] << " writebacks " << caches.writebacks[level] <<
+            ", invalidations " << caches.invalidations[level] << endl;
+    cout << "Memory reads " << caches.memory_reads << " words, writes " << caches.memory_writes << " words" << endl;
 }
 
 /*
-    less_than(regs[], val1, val2, dst)
-    checks if val1 is less than val2
-        if it is, stores 1 in regs[dst]- otherwise, stores 0
+    print_fetches(caches)
+    prints the hits and misses of the instruction and data sides of each level: fetches
+        and lw in L1I and L1, then both in each level below
     parameters:
-        regs[] = an array containing the values of regs 1-7
-        val1 = first operand of less-than operation
-        val2 = second operand to less-than operation
-        dst = register to store 0 or 1 in, depending on outcome of less-than operation
+        caches = caches of a finished run, with an instruction cache
  */
-void less_than(uint16_t regs[], uint16_t val1, uint16_t val2, int dst) {
-    if (val1 < val2) {
-        regs[dst] = 1;
-    }
-    else {
-        regs[dst] = 0;
+template <int Levels, bool Fetch>
+void print_fetches(const CacheObserver<Levels, Fetch> &caches) {
+    cout << "L1I hits " << caches.fetch_hits[0] << ", misses " << caches.fetch_misses[0] <<
+        ", invalidations " << caches.fetch_invalidations << endl;
+    cout << "L1D hits " << caches.hits[0] << ", misses " << caches.misses[0] << endl;
+    for (int level = 1; level < Levels; level++)
+        cout << CACHE_NAMES[level] << " instruction hits " << caches.fetch_hits[level] << ", misses " <<
+            caches.fetch_misses[level] << ", data hits " << caches.hits[level] << ", misses " <<
+            caches.misses[level] << endl;
+}
+
+/*
+    print_prefetches(caches)
+    prints what the prefetcher of each level that has one did: the blocks it prefetched, how
+        many were useful and useless, its accuracy and coverage (see prefetch_rates), its
+        timeliness as the average lead from a useful prefetch to its first use, and the
+        pollution it caused, as misses on blocks a prefetch evicted
+    parameters:
+        caches = caches of a finished run
+ */
+template <int Levels, bool Fetch>
+void print_prefetches(const CacheObserver<Levels, Fetch> &caches) {
+    cout << fixed << setprecision(4);
+    for (int level = 0; level < Levels; level++) {
+        if (caches.caches[level].prefetch == PREFETCH_NONE)
+            continue;
+        double accuracy, coverage, lead;
+        prefetch_rates(caches, level, accuracy, coverage, lead);
+        cout << CACHE_NAMES[level] << " prefetches " << caches.prefetches[level] << ", useful " <<
+            caches.useful_prefetches[level] << ", useless " << caches.useless_prefetches[level] <<
+            ", accuracy " << accuracy << ", coverage " << coverage << ", lead " << lead <<
+            " accesses, pollution " << caches.pollution[level] << " misses" << endl;
     }
 }
 
 /*
-    sign_extend(imm, msb)
-    checks if the msb of imm is 0 or 1
-        if its 1, it sign extends imm so its 16 bits
+    print_summary(caches)
+    prints, for each level, its accesses, hits, misses and hit rate, then the same for its
+        loads (lw in L1, the reads reaching it below) and its stores (sw) apart, then how many
+        of its misses were compulsory, capacity and conflict misses (see CacheSummary); then
+        the table of misses by pc, the pc with the most L1 misses first
     parameters:
-        imm = immediate value
-        msb = number indicating which bit is the most significant bit of imm
+        caches = caches of a finished run, with a summary
  */
-uint16_t sign_extend(uint16_t imm, int msb) {
-    uint16_t check = 1 << (msb - 1);
-    if ((imm & check) == check) {
-        // sign extend by 1
-        if (msb == 7) {
-            // 65408 = 1111111110000000
-            imm = (imm | 65408);
+template <int Levels, bool Fetch>
+void print_summary(const CacheObserver<Levels, Fetch> &caches) {
+    const CacheSummary &s = *caches.summary;
+    auto rate = [](uint64_t hits, uint64_t misses) {
+        return hits + misses > 0 ? (double)hits / (hits + misses) : 0.0;
+    };
+    cout << fixed << setprecision(4);
+    for (int level = 0; level < Levels; level++) {
+        string name = CACHE_NAMES[level];
+        uint64_t hits = caches.hits[level] + s.store_hits[level];
+        uint64_t misses = caches.misses[level] + s.store_misses[level];
+        cout << name << " accesses " << hits + misses << ", hits " << hits << ", misses " << misses <<
+            ", hit rate " << rate(hits, misses) << endl;
+        cout << name << " loads " << caches.hits[level] + caches.misses[level] << ", hits " << caches.hits[level] <<
+            ", misses " << caches.misses[level] << ", hit rate " << rate(caches.hits[level], caches.misses[level]) << endl;
+        cout << name << " stores " << s.store_hits[level] + s.store_misses[level] << ", hits " << s.store_hits[level] <<
+            ", misses " << s.store_misses[level] << ", hit rate " << rate(s.store_hits[level], s.store_misses[level]) <<
+            endl;
+        cout << name << " misses compulsory " << s.compulsory[level] << ", capacity " << s.capacity[level] <<
+            ", conflict " << s.conflict[level] << endl;
+    }
+    vector<int> pcs;
+    for (int pc = 0; pc < (int)MEM_SIZE; pc++) {
+        for (int level = 0; level < Levels; level++) {
+            if (s.pc_misses[level * MEM_SIZE + pc] > 0) {
+                pcs.push_back(pc);
+                break;
+            }
         }
-        else { // msb == 13
-            // 57344 = 1110000000000000
-            imm = imm | 57344;
+    }
+    stable_sort(pcs.begin(), pcs.end(), [&](int a, int b) {
+        return s.pc_misses[a] > s.pc_misses[b];
+    });
+    cout << "Misses by pc" << endl;
+    cout << setw(6) << "pc" << setw(12) << "accesses";
+    for (int level = 0; level < Levels; level++)
+        cout << setw(12) << string(CACHE_NAMES[level]) + " misses" << (level == 0 ? "   L1 rate" : "");
+    cout << endl;
+    for (int pc : pcs) {
+        cout << setw(6) << pc << setw(12) << s.pc_accesses[pc];
+        for (int level = 0; level < Levels; level++) {
+            cout << setw(12) << s.pc_misses[level * MEM_SIZE + pc];
+            if (level == 0)
+                cout << setw(9) << fixed << setprecision(2) <<
+                    (s.pc_accesses[pc] > 0 ? 100.0 * s.pc_misses[pc] / s.pc_accesses[pc] : 0.0) << "%";
         }
+        cout << endl;
     }
-    return imm;
 }
 
 /*
-    find_twos_complement(imm, msb)
-    checks if most significant bit of imm is 0 or 1
-        if its 1, it finds the twos complement of imm
-            sign extends imm
-            flips imms bits
-            adds 1 to imm
-        then multiplies imm by negative 1 to finish the process
+    print_timing(caches, latency, base_cycles, instructions)
+    prints the cycles a run took, its CPI, and the average memory access time of each level
     parameters:
-        imm = immediate value
-        msb = number indicating which bit is the most significant bit of imm
- */
-int find_twos_complement(int imm, int msb) {
-    // pass in integer
-    // sign extend
-    // if MSB == 1
-    uint16_t check = 1 << (msb - 1);
-    // check if imm is negative
-    if ((imm & check) == check) {
-        // sign extend imm
-        imm = sign_extend(imm, msb);
-        // flip its bits
-        imm = imm ^ 65535;
-        // add 1
-        imm = imm + 1;
-        imm = imm * -1;
-    }
-    return imm;
-}
-
-/*
-    create_vector_of_rows(num_of_rows)
-    creates a cache containing empty rows (vectors)
+        caches = caches of a finished run
+        latency = hit latency of each level, L1 (and L1I) first, then memory's latency
+        base_cycles = cycles of the instructions executed, without their memory accesses
+        instructions = instructions executed
+ */
+template <int Levels, bool Fetch>
+void print_timing(const CacheObserver<Levels, Fetch> &caches, const vector<int> &latency, uint64_t base_cycles,
+        uint64_t instructions) {
+    uint64_t cycles = base_cycles + memory_cycles(caches, Levels, latency);
+    double amat[Levels];
+    double fetch_amat;
+    access_times(caches, Levels, latency, amat, fetch_amat);
+    cout << fixed << setprecision(4);
+    cout << "Cycles " << cycles << ", instructions " << instructions << ", CPI " <<
+        (instructions > 0 ? (double)cycles / instructions : 0.0) << endl;
+    for (int level = 0; level < Levels; level++) {
+        cout << CACHE_NAMES[level] << " AMAT " << amat[level] << " cycles" << endl;
+        if (Fetch && level == 0)
+            cout << "L1I AMAT " << fetch_amat << " cycles" << endl;
+    }
+}
+
+/*
+    executed_base_cycles(stats, base, instructions)
+    returns the cycles of the instructions a run executed, without their memory accesses
     parameters:
-        num_of_rows = number of rows in cache being created
+        stats = statistics of the run
+        base = cycles of each kind of instruction
+        instructions = receives the number of instructions executed
  */
-vector<vector<int>> create_cache(int num_of_rows) {
-    // create vector of rows
-        // each row stores tag
-    vector<vector<int>> L1;
-    vector<int> empty;
-    for (int i = 0; i < num_of_rows; i++) {
-        L1.push_back(empty);
+uint64_t executed_base_cycles(const ExecStats &stats, const uint64_t base[NUM_INSTR_KINDS], uint64_t &instructions) {
+    uint64_t cycles = 0;
+    instructions = 0;
+    for (int kind = 0; kind < NUM_INSTR_KINDS; kind++) {
+        cycles += stats.kind_count[kind] * base[kind];
+        instructions += stats.kind_count[kind];
     }
-    return L1;
+    return cycles;
 }
 
 /*
-    add_tag(cache_row, assoc, tag)
-    checks if cache_row is full
-        if it is -> evict LRU
-    adds tag to cache_row
+    replayed_base_cycles(recorder, base, instructions)
+    returns the cycles of the instructions of a replayed trace, without their memory accesses
+        a trace only tells lw and sw from the rest, which all take the cycles of add
     parameters:
-        cache_row = cache row tag is being added to
-        assoc = associativity of cache which cache row comes from
-        tag = val being added to cache_row
+        recorder = accesses read from the trace
+        base = cycles of each kind of instruction
+        instructions = receives the number of instructions in the trace
  */
-void add_tag(vector<int>& cache_row, int assoc, int tag) {
-    // if row is full, an eviction needs to happen
-    if (cache_row.size() == assoc) {
-        // evict LRU, aka first element in L1 vector
-        cache_row.erase(cache_row.begin());
+uint64_t replayed_base_cycles(const AccessRecorder &recorder, const uint64_t base[NUM_INSTR_KINDS],
+        uint64_t &instructions) {
+    uint64_t lws = 0;
+    uint64_t sws = 0;
+    for (uint16_t access : recorder.accesses) {
+        if (access & SWEEP_SW)
+            sws++;
+        else if (!(access & SWEEP_FETCH))
+            lws++;
     }
-    // add current element to end of cache_row
-    cache_row.push_back(tag);
+    instructions = recorder.instructions;
+    return lws * base[KIND_LW] + sws * base[KIND_SW] + (instructions - lws - sws) * base[KIND_ADD];
 }
 
 /*
-    cache_lw(mem_addr, blocksize, num_rows, cache, cache_name, pc, assoc)
-    calculates the desired tag/row for a lw operation and searches a given cache for that tag/row combination
-        if the tag/row combination exists in the cache -> cache hit is recorded
-        else -> cache miss is recorded
-            if cache row is full, evicts LRU element
-            loads desired tag to desired cache row
-    returns cache row containing desired tag, bool indicating if it was a hit or miss, and int indicating which cache row is being returned
+    parse_policies(spec, names, policies)
+    parses a comma separated list of policy names, one per level, L1 first
+    returns false if a name isn't one of names
     parameters:
-        mem_addr = memory address being loaded in lw operation
-        blocksize = size of blocks stored in/loaded to cache
-        num_rows = number of rows in cache
-        cache = cache being searched for row/tag combination
-        cache_name = name of cache being searched
-        pc = program counter
-        assoc = associativity of cache being searched
- */
-tuple<vector<int>, bool, int> cache_lw(int mem_addr, int blocksize, int num_rows, vector<vector<int>> cache, const string& cache_name, int pc, int assoc) {
-    int blockid = floor(mem_addr / blocksize);
-    int row = blockid % num_rows;
-    int tag = floor(blockid / num_rows);
-    // find row in cache we're searching
-    vector<int> cache_row = cache[row];
-    // track if tag is found in cache_row
-    bool hit = false;
-    // check if tag is already in row
-    for (int i = 0; i < cache_row.size(); i++) {
-        if (cache_row[i] == tag) { // cache hit
-            hit = true;
-            // remove found tag- need to add to the end of cache_row to preserve LRU
-            cache_row.erase(cache_row.begin() + i);
-            // add the entry back to the end of cache_row
-            cache_row.push_back(tag);
-            print_log_entry(cache_name, "HIT", pc, mem_addr, row);
-            break;
-        }
+        spec = list to parse
+        names = names of the policies, in the order of Policy
+        policies = receives the policies
+ */
+template <typename Policy, size_t N>
+bool parse_policies(const string &spec, const char *const (&names)[N], vector<Policy> &policies) {
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == string::npos)
+            end = spec.size();
+        const char *const *found = find(names, names + N, spec.substr(start, end - start));
+        if (found == names + N)
+            return false;
+        policies.push_back((Policy)(found - names));
+        start = end + 1;
     }
-    if (hit == false) { // cache miss
-        print_log_entry(cache_name, "MISS", pc, mem_addr, row);
-        add_tag(cache_row, assoc, tag);
+    return true;
+}
+
+/*
+    parse_numbers(spec, numbers)
+    parses a comma separated list of numbers into numbers
+    returns false if spec is malformed
+ */
+bool parse_numbers(const string &spec, vector<int> &numbers) {
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == string::npos)
+            end = spec.size();
+        string part = spec.substr(start, end - start);
+        if (part.empty() || part.size() > 9 || part.find_first_not_of("0123456789") != string::npos)
+            return false;
+        numbers.push_back(stoi(part));
+        start = end + 1;
     }
-    return {cache_row, hit, row};
+    return true;
 }
 
 /*
-    cache_sw(mem_addr, blocksize, num_rows, cache, assoc, cache_name, pc)
-    calculates the desired tag/row for a sw operation
-        adds the desired tag to the desired row of the cache
-    returns cache row containing which now contains desired tag and int indicating which cache row is being returned
-    parameters:
-        mem_addr = memory address being loaded in lw operation
-        blocksize = size of blocks stored in/loaded to cache
-        num_rows = number of rows in cache
-        cache = cache being searched for row/tag combination
-        assoc = associativity of cache being searched
-        cache_name = name of cache being searched
-        pc = program counter
- */
-tuple<vector<int>, int> cache_sw(int mem_addr, int blocksize, int num_rows, vector<vector<int>> cache, int assoc, const string& cache_name, int pc) {
-    int blockid = floor(mem_addr / blocksize);
-    int row = blockid % num_rows;
-    int tag = floor(blockid / num_rows);
-    vector<int> cache_row = cache[row];
-    add_tag(cache_row, assoc, tag);
-    print_log_entry(cache_name, "SW", pc, mem_addr, row);
-    return {cache_row, row};
-}
-
-/*
-    execute(mem, pc, regs, num_of_cache)
-    gets the current instruction to execute mem[pc]
-        based on the opcode of the current instruction, executes the current sequence of operations
-        updates cache if current opcode is lw or sw
+    parse_prefetchers(spec, prefetchers)
+    parses a comma separated list of prefetchers, one per level, L1 first, each a
+        Prefetcher name followed by :DEGREE and :DISTANCE if they aren't 1, e.g. stride:2:4
+    returns false if spec is malformed
     parameters:
-        mem[] = array containing the memory cells 0-8191
-        pc = program counter, tracks which mem cell should currently execute
-        regs[] = array containing the values of regs 1-7
-        blocksize[] = array containing blocksize of L1 cache (and L2 cache, if applicable)
-        num_rows[] = array containing number of rows in L1 cache (and L2 cache, if applicable)
-        assoc[] = array containing associativity of L1 cache (and L2 cache, if applicable)
-        num_of_cache = indicates the number of caches
-        vector<vector<int>>& L1 = vector representing L1 cache
-        vector<vector<int>>& L2 = vector representing L2 cache
- */
- // when passing an array by name, you're actually passing a pointer to the first element in the array
-    // thus, it'll modify the original array you passed in, not a copy
-    // passing an array by reference isn't a thing
-vector<uint16_t> execute(uint16_t mem[], uint16_t pc, uint16_t regs[], int blocksize[], int num_rows[], int assoc[], int num_of_cache, vector<vector<int>>& L1, vector<vector<int>>& L2) {
-    // when accessing memory, only use the 13 lsb of the pc
-    // 8191 = 1111111111111
-    uint16_t mem_pc = pc & 8191;
-    uint16_t curr_instr = mem[mem_pc];
-    // tracks if you're instruction jumps or not
-    bool jump = false;
-    // increment program counter
-        // if instruction caused jump, will update new_pc later
-    uint16_t new_pc = pc + 1;
-    // tracks if instruction was a halt
-    bool halt = false;
-    // & curr_instr with 11100000000000000 to get 3 msb
-    int three_msb = curr_instr & 57344;
-    three_msb = three_msb >> 13;
-    // 3 register arguments
-    if (three_msb == 0) {
-        // 15 = 0000000000001111
-        int four_lsb = curr_instr & 15;
-        // 7168 = 0001110000000000
-        int srcA = curr_instr & 7168;
-        srcA = srcA >> 10;
-        // 896 = 0000001110000000
-        int srcB = curr_instr & 896;
-        srcB = srcB >> 7;
-        int dst = curr_instr & 112;
-        dst = dst >> 4;
-        // register 0 is immutable
-        if (dst != 0) {
-            if (four_lsb == 0) {
-                // add
-                int val1 = regs[srcA];
-                int val2 = regs[srcB];
-                ALU(regs, val1, val2, dst, "add");
-            }
-            else if (four_lsb == 1) {
-                // sub
-                int val1 = regs[srcA];
-                int val2 = regs[srcB];
-                ALU(regs, val1, val2, dst, "sub");
-            }
-            else if (four_lsb == 2) {
-                // or
-                uint16_t bitwise_or = regs[srcA] | regs[srcB];
-                regs[dst] = bitwise_or;
-            }
-            else if (four_lsb == 3) {
-                // and
-                uint16_t bitwise_and = regs[srcA] & regs[srcB];
-                regs[dst] = bitwise_and;
-            }
-            else if (four_lsb == 4) {
-                // slt
-                uint16_t val1 = regs[srcA];
-                uint16_t val2 = regs[srcB];
-                less_than(regs, val1, val2, dst);
-            }
-        }
-        // jr doesn't modify regDst
-            // thus, it doesn't matter if regDst == 0
-        if (four_lsb == 8) {
-            // jr
-            new_pc = regs[srcA];
-            jump = true;
-        }
-    }
-    // no register arguments
-    else if ((three_msb == 2) | (three_msb == 3)) {
-        // 8191 = 0001111111111111
-        // imm = non-negative absolute address
-        int imm = curr_instr & 8191;
-        if (three_msb == 2) {
-            // j
-            new_pc = imm;
-            jump = true;
-            // check for halt
-            if (new_pc == pc) {
-                halt = true;
-            }
+        spec = list to parse, as given to --prefetch
+        prefetchers = receives the prefetchers
+ */
+bool parse_prefetchers(const string &spec, vector<PrefetchConfig> &prefetchers) {
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(start, end - start);
+        size_t colon = item.find(':');
+        vector<Prefetcher> kind;
+        vector<int> numbers = {1, 1};
+        if (!parse_policies(item.substr(0, colon), PREFETCHER_NAMES, kind))
+            return false;
+        if (colon != string::npos) {
+            string values = item.substr(colon + 1);
+            replace(values.begin(), values.end(), ':', ',');
+            numbers.clear();
+            if (!parse_numbers(values, numbers) || numbers.size() > 2)
+                return false;
+            numbers.resize(2, 1);
         }
-        else { // three_msb == 3
-            // jal
-            // ****************
-            regs[7] = pc + 1;
-            new_pc = imm;
-            jump = true;
+        prefetchers.push_back({kind[0], numbers[0], numbers[1]});
+        start = end + 1;
+    }
+    return true;
+}
+
+/*
+    parse_base_cycles(spec, base, by_kind)
+    parses a comma separated list of KIND=N, each the cycles an instruction of kind KIND
+        (an InstrKind name, e.g. add or lw) takes besides its memory accesses, into base;
+        the kind default stands for every kind not listed, which otherwise take 1 cycle
+    returns false if spec is malformed
+    parameters:
+        spec = list to parse, as given to --base-cycles
+        base = receives the cycles of each kind
+        by_kind = set to whether spec gives a kind other than lw and sw cycles of its own
+ */
+bool parse_base_cycles(const string &spec, uint64_t base[NUM_INSTR_KINDS], bool &by_kind) {
+    int cycles[NUM_INSTR_KINDS];
+    fill(cycles, cycles + NUM_INSTR_KINDS, -1);
+    int others = 1;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(start, end - start);
+        size_t equals = item.find('=');
+        vector<int> value;
+        if (equals == string::npos || !parse_numbers(item.substr(equals + 1), value) || value.size() != 1)
+            return false;
+        string name = item.substr(0, equals);
+        int kind = find(INSTR_KIND_NAMES, INSTR_KIND_NAMES + NUM_INSTR_KINDS, name) - INSTR_KIND_NAMES;
+        if (name == "default")
+            others = value[0];
+        else if (kind == NUM_INSTR_KINDS)
+            return false;
+        else {
+            cycles[kind] = value[0];
+            by_kind |= kind != KIND_LW && kind != KIND_SW;
         }
+        start = end + 1;
     }
-    // two register arguments
-    else {
-        int src = curr_instr & 7168;
-        src = src >> 10;
-        int dst = curr_instr & 896;
-        dst = dst >> 7;
-        // 127 = 0000000001111111
-        int imm = curr_instr & 127;
-        // slti, lw, addi
-        if (dst != 0) {
-            if (three_msb == 7) {
-                // slti
-                // only op where imm = unsigned
-                uint16_t val1 = regs[src];
-                imm = sign_extend(imm, 7);
-                less_than(regs, val1, imm, dst);
-            }
-            else if (three_msb == 4) {
-                // lw
-                int addr = regs[src];
-                // check if imm is negative
-                imm = find_twos_complement(imm, 7);
-                // only least significant 13 bits of mem_addr are used to index into memory
-                int mem_addr = (imm + addr) & 8191;
-                int read_from_memory = mem[mem_addr];
-                regs[dst] = read_from_memory;
-                // CACHE
-                // cache L1
-                tuple<vector<int>, bool, int> return_val_L1 = cache_lw(mem_addr, blocksize[0], num_rows[0], L1, "L1", pc, assoc[0]);
-                bool hit = get<1>(return_val_L1);
-                int row_L1 = get<2>(return_val_L1);
-                L1[row_L1] = get<0>(return_val_L1);
-                if (hit == false) { // cache miss on L1
-                    if (num_of_cache == 2) { // consult L2 if there is a L1 miss
-                        tuple<vector<int>, bool, int> return_val_L2 = cache_lw(mem_addr, blocksize[1], num_rows[1], L2, "L2", pc, assoc[1]);
-                        int row_L2 = get<2>(return_val_L2);
-                        L2[row_L2] = get<0>(return_val_L2);
-                    }
-                }
-            }
-            else if (three_msb == 1) {
-                // addi
-                int val1 = regs[src];
-                imm = find_twos_complement(imm, 7);
-                ALU(regs, val1, imm, dst, "addi");
-            }
+    for (int kind = 0; kind < NUM_INSTR_KINDS; kind++)
+        base[kind] = cycles[kind] >= 0 ? cycles[kind] : others;
+    return true;
+}
+
+/*
+    parse_cache_config(spec, levels)
+    parses size,associativity,blocksize for each level, L1 first, into levels, with the default policies
+    returns false if spec isn't a list of numbers, three per level
+    parameters:
+        spec = configuration to parse, as given to --cache
+        levels = receives the configuration of each level
+ */
+bool parse_cache_config(const string &spec, vector<LevelConfig> &levels) {
+    vector<int> parts;
+    if (!parse_numbers(spec, parts) || parts.size() % 3 != 0)
+        return false;
+    // each level is size,associativity,blocksize
+    for (size_t i = 0; i < parts.size(); i += 3)
+        levels.push_back({parts[i], parts[i + 1], parts[i + 2], REPL_LRU, WRITE_THROUGH, NINE, {PREFETCH_NONE, 1, 1}});
+    return true;
+}
+
+/*
+    parse_hierarchy(name, levels, icache, has_icache, error)
+    reads a cache hierarchy from the file name: a line per level, L1 first, each
+        size,associativity,blocksize followed by any of the level's replacement, write
+        and inclusion policy names and prefetcher, and optionally a line for an L1
+        instruction cache, starting with icache, e.g.
+            64,4,4 plru wb stride:2
+            icache 32,2,4 fifo
+            1024,8,8 wb inclusive
+        blank lines, and anything after #, are ignored
+    returns false, with a description in error, if the file can't be read or is malformed
+    parameters:
+        name = name of the file
+        levels = receives the configuration of each level
+        icache = receives the configuration of the instruction cache
+        has_icache = set to whether the file has an instruction cache
+        error = receives the error message
+ */
+bool parse_hierarchy(const string &name, vector<LevelConfig> &levels, LevelConfig &icache, bool &has_icache,
+        string &error) {
+    ifstream file(name);
+    if (!file.is_open()) {
+        error = "Can't open file " + name;
+        return false;
+    }
+    string line;
+    for (int number = 1; getline(file, line); number++) {
+        istringstream words(line.substr(0, line.find('#')));
+        string word;
+        if (!(words >> word))
+            continue;
+        bool is_icache = word == "icache";
+        vector<LevelConfig> level;
+        bool ok = !(is_icache && (has_icache || !(words >> word))) && parse_cache_config(word, level) &&
+            level.size() == 1;
+        while (ok && words >> word) {
+            vector<Replacement> replacement;
+            vector<WritePolicy> write;
+            vector<Inclusion> inclusion;
+            vector<PrefetchConfig> prefetch;
+            if (parse_policies(word, REPLACEMENT_NAMES, replacement) && replacement.size() == 1)
+                level[0].replacement = replacement[0];
+            else if (parse_policies(word, WRITE_POLICY_NAMES, write) && write.size() == 1)
+                level[0].write = write[0];
+            else if (parse_policies(word, INCLUSION_NAMES, inclusion) && inclusion.size() == 1)
+                level[0].inclusion = inclusion[0];
+            else if (parse_prefetchers(word, prefetch) && prefetch.size() == 1)
+                level[0].prefetch = prefetch[0];
+            else
+                ok = false;
         }
-        // sw & jeq don't modify regDst
-            // thus, it doesn't matter if regDst == 0
-        if (three_msb == 5) {
-            // sw
-            int addr = regs[src];
-            imm = find_twos_complement(imm, 7);
-            int mem_addr = (imm + addr) & 8191;
-            int write_to_memory = regs[dst];
-            mem[mem_addr] = write_to_memory;
-            // CACHE
-            tuple<vector<int>, int> return_val_L1 = cache_sw(mem_addr, blocksize[0], num_rows[0], L1, assoc[0], "L1", pc);
-            int row_L1 = get<1>(return_val_L1);
-            L1[row_L1] = get<0>(return_val_L1);
-            if (num_of_cache == 2) {
-                tuple<vector<int>, int> return_val_L2 = cache_sw(mem_addr, blocksize[1], num_rows[1], L2, assoc[1], "L2", pc);
-                int row_L2 = get<1>(return_val_L2);
-                L2[row_L2] = get<0>(return_val_L2);
-            }
+        if (!ok) {
+            error = "Invalid cache config in " + name + " line " + to_string(number) + ": " + line;
+            return false;
         }
-        else if (three_msb == 6){
-            // jeq
-            int val1 = regs[src];
-            int val2 = regs[dst];
-            if (val1 == val2) {
-                // jump
-                // sign extend the rel_imm and find out if its
-                // imm = rel_imm
-                imm = find_twos_complement(imm, 7);
-                new_pc = pc + imm + 1;
-                jump = true;
-            }
+        if (is_icache) {
+            icache = level[0];
+            has_icache = true;
         }
-
+        else
+            levels.push_back(level[0]);
     }
-    uint16_t stop;
-    if (halt) {
-        stop = 1;
-    }
-    else {
-        stop = 0;
+    return true;
+}
+
+/*
+    set_policies(levels, replacement, write, inclusion, prefetch)
+    gives each level the policies and prefetcher listed for it, leaving the rest at their defaults
+    parameters:
+        levels = configuration of each level, L1 first
+        replacement, write, inclusion, prefetch = policies and prefetchers of the first levels, L1 first
+ */
+void set_policies(vector<LevelConfig> &levels, const vector<Replacement> &replacement,
+        const vector<WritePolicy> &write, const vector<Inclusion> &inclusion, const vector<PrefetchConfig> &prefetch) {
+    for (size_t level = 0; level < levels.size(); level++) {
+        if (level < replacement.size())
+            levels[level].replacement = replacement[level];
+        if (level < write.size())
+            levels[level].write = write[level];
+        if (level < inclusion.size())
+            levels[level].inclusion = inclusion[level];
+        if (level < prefetch.size())
+            levels[level].prefetch = prefetch[level];
     }
-    vector<uint16_t> return_vals;
-    return_vals.push_back(new_pc);
-    return_vals.push_back(stop);
-    return return_vals;
 }
 
 /*
@@ -508,18 +2457,119 @@ int main(int argc, char *argv[]) {
     char *filename = nullptr;
     bool do_help = false;
     bool arg_error = false;
-    string cache_config;
+    vector<string> cache_configs;
+    char *replay_name = nullptr;
+    char *checkpoint = nullptr;
+    uint64_t checkpoint_every = 0;
+    char *restore = nullptr;
+    bool do_stats = false;
+    bool do_summary = false;
+    bool quiet = false;
+    bool do_stack_distance = false;
+    char *sweep = nullptr;
+    size_t threads = 0;
+    char *trace_text = nullptr;
+    vector<Replacement> replacement;
+    vector<WritePolicy> write;
+    bool write_given = false;
+    vector<Inclusion> inclusion;
+    bool inclusion_given = false;
+    vector<PrefetchConfig> prefetch;
+    char *hierarchy = nullptr;
+    char *icache_config = nullptr;
+    vector<int> latency;
+    uint64_t base_cycles[NUM_INSTR_KINDS];
+    fill(base_cycles, base_cycles + NUM_INSTR_KINDS, 1);
+    bool base_given = false;
+    bool base_by_kind = false;
+    uint64_t seed = 1;
     for (int i=1; i<argc; i++) {
         string arg(argv[i]);
         if (arg.rfind("-",0)==0) {
             if (arg== "-h" || arg == "--help")
                 do_help = true;
-            else if (arg=="--cache") {
+            else if (arg=="--stats")
+                do_stats = true;
+            else if (arg=="--summary")
+                do_summary = true;
+            else if (arg=="--quiet")
+                quiet = true;
+            else if (arg=="--stack-distance")
+                do_stack_distance = true;
+            else if (arg=="--cache" || arg=="--replay" || arg=="--sweep") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else if (arg=="--cache")
+                    cache_configs.push_back(argv[i]);
+                else if (arg=="--sweep")
+                    sweep = argv[i];
+                else
+                    replay_name = argv[i];
+            }
+            else if (arg=="--replacement") {
+                i++;
+                if (i>=argc || !parse_policies(argv[i], REPLACEMENT_NAMES, replacement))
+                    arg_error = true;
+            }
+            else if (arg=="--write") {
+                i++;
+                if (i>=argc || !parse_policies(argv[i], WRITE_POLICY_NAMES, write))
+                    arg_error = true;
+                write_given = true;
+            }
+            else if (arg=="--prefetch") {
+                i++;
+                if (i>=argc || !parse_prefetchers(argv[i], prefetch))
+                    arg_error = true;
+            }
+            else if (arg=="--latency") {
+                i++;
+                if (i>=argc || !parse_numbers(argv[i], latency))
+                    arg_error = true;
+            }
+            else if (arg=="--base-cycles") {
+                i++;
+                if (i>=argc || !parse_base_cycles(argv[i], base_cycles, base_by_kind))
+                    arg_error = true;
+                base_given = true;
+            }
+            else if (arg=="--inclusion") {
+                i++;
+                if (i>=argc || !parse_policies(argv[i], INCLUSION_NAMES, inclusion))
+                    arg_error = true;
+                inclusion_given = true;
+            }
+            else if (arg=="--threads" || arg=="--seed") {
+                i++;
+                if (i>=argc || string(argv[i]).empty() || string(argv[i]).size() > 19 ||
+                        string(argv[i]).find_first_not_of("0123456789") != string::npos)
+                    arg_error = true;
+                else if (arg=="--seed")
+                    seed = stoull(argv[i]);
+                else
+                    threads = stoul(argv[i]);
+            }
+            else if (arg=="--checkpoint" || arg=="--checkpoint-every" || arg=="--restore" ||
+                    arg=="--trace-text" || arg=="--hierarchy" || arg=="--icache") {
                 i++;
                 if (i>=argc)
                     arg_error = true;
+                else if (arg=="--hierarchy")
+                    hierarchy = argv[i];
+                else if (arg=="--icache")
+                    icache_config = argv[i];
+                else if (arg=="--trace-text")
+                    trace_text = argv[i];
+                else if (arg=="--checkpoint")
+                    checkpoint = argv[i];
+                else if (arg=="--restore")
+                    restore = argv[i];
+                else if (!string(argv[i]).empty() && string(argv[i]).size() <= 19 &&
+                        string(argv[i]).find_first_not_of("0123456789") == string::npos)
+                    checkpoint_every = stoull(argv[i]);
                 else
-                    cache_config = argv[i];
+                    arg_error = true;
             }
             else
                 arg_error = true;
@@ -530,9 +2580,62 @@ int main(int argc, char *argv[]) {
                 arg_error = true;
         }
     }
+    if (checkpoint_every > 0 && checkpoint == nullptr)
+        arg_error = true;
+    // a checkpoint holds the program, so there is no filename to load as well
+    if (restore != nullptr && filename != nullptr)
+        arg_error = true;
+    // a replay has no program to run, so nothing to checkpoint, count or trace
+    if (replay_name != nullptr && (filename != nullptr || restore != nullptr || checkpoint != nullptr ||
+            do_stats || trace_text != nullptr))
+        arg_error = true;
+    // a hierarchy file gives the caches and their policies itself
+    if (hierarchy != nullptr && (cache_configs.size() > 0 || replacement.size() > 0 || write_given ||
+            inclusion_given || prefetch.size() > 0 || icache_config != nullptr))
+        arg_error = true;
+    // only a replay can be repeated for several caches
+    if (replay_name == nullptr && cache_configs.size() > 1)
+        arg_error = true;
+    // the analysis covers every cache itself, and keeps no state a checkpoint could save
+    if (do_stack_distance && (cache_configs.size() > 0 || hierarchy != nullptr || icache_config != nullptr ||
+            checkpoint != nullptr))
+        arg_error = true;
+    // nor does a sweep
+    if (sweep != nullptr && (cache_configs.size() > 0 || hierarchy != nullptr || checkpoint != nullptr ||
+            do_stack_distance))
+        arg_error = true;
+    // the stack distances are those of LRU
+    if (do_stack_distance && (replacement.size() > 0 || write_given || inclusion_given || prefetch.size() > 0))
+        arg_error = true;
+    // the summary is of a run through one set of caches
+    if ((do_summary || quiet) && (do_stack_distance || sweep != nullptr))
+        arg_error = true;
+    // the timing model adds up the latencies of the simulated caches
+    if ((base_given && latency.empty()) || (do_stack_distance && !latency.empty()))
+        arg_error = true;
+    // a trace doesn't record which instruction each one was, only the lw and sw
+    if (replay_name != nullptr && base_by_kind)
+        arg_error = true;
+    // one policy per level, the defaults for the levels not given one
+    if (replacement.size() > MAX_LEVELS || write.size() > MAX_LEVELS || inclusion.size() > MAX_LEVELS ||
+            prefetch.size() > MAX_LEVELS)
+        arg_error = true;
     /* Display error message if appropriate */
-    if (arg_error || do_help || filename == nullptr) {
-        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] filename" << endl << endl;
+    if (arg_error || do_help || (filename == nullptr && restore == nullptr && replay_name == nullptr)) {
+        cerr << "usage " << argv[0] << " [-h] [--cache CACHE [--icache CACHE] | --hierarchy FILE] [--checkpoint FILE [--checkpoint-every N]]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--replacement POLICIES] [--write POLICIES] [--inclusion POLICIES]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--prefetch PREFETCHERS] [--latency LATENCIES [--base-cycles CYCLES]]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--seed N] [--stats] [--summary] [--quiet] [--trace-text FILE]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " (filename | --restore FILE)" << endl;
+        cerr << "      " << argv[0] << " [-h] --replay TRACE [--replacement POLICIES] [--write POLICIES]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--inclusion POLICIES] [--seed N] [--cache CACHE... [--icache CACHE] | --hierarchy FILE]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--prefetch PREFETCHERS] [--latency LATENCIES [--base-cycles CYCLES]]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--summary] [--quiet]" << endl;
+        cerr << "      " << argv[0] << " [-h] --stack-distance (filename | --restore FILE | --replay TRACE)" << endl;
+        cerr << "      " << argv[0] << " [-h] --sweep SPEC [--threads N] [--icache CACHE] [--replacement POLICIES] [--write POLICIES]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--inclusion POLICIES] [--prefetch PREFETCHERS]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--latency LATENCIES [--base-cycles CYCLES]]" << endl;
+        cerr << "      " << string(strlen(argv[0]), ' ') << " [--seed N] (filename | --restore FILE | --replay TRACE)" << endl << endl;
         cerr << "Simulate E20 cache" << endl << endl;
         cerr << "positional arguments:" << endl;
         cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
@@ -541,91 +2644,312 @@ int main(int argc, char *argv[]) {
         cerr << "  --cache CACHE  Cache configuration: size,associativity,blocksize (for one"<<endl;
         cerr << "                 cache) or"<<endl;
         cerr << "                 size,associativity,blocksize,size,associativity,blocksize"<<endl;
-        cerr << "                 (for two caches)"<<endl;
+        cerr << "                 (for two caches), and so on up to four levels, L1 first;"<<endl;
+        cerr << "                 may be repeated with --replay"<<endl;
+        cerr << "  --hierarchy FILE  Cache configuration and policies from FILE instead of"<<endl;
+        cerr << "                 --cache and the policy options: a line per level, L1"<<endl;
+        cerr << "                 first, of size,associativity,blocksize followed by the"<<endl;
+        cerr << "                 level's policy names, e.g. 1024,8,8 wb inclusive; # starts"<<endl;
+        cerr << "                 a comment; a line icache size,associativity,blocksize"<<endl;
+        cerr << "                 [replacement] adds an L1 instruction cache"<<endl;
+        cerr << "  --icache CACHE  L1 instruction cache: size,associativity,blocksize; every"<<endl;
+        cerr << "                 instruction fetch goes through it, and on to L2 (shared"<<endl;
+        cerr << "                 with data) when it misses; fetches aren't logged, but the"<<endl;
+        cerr << "                 instruction and data hits and misses of each level are"<<endl;
+        cerr << "                 printed after the log, or added to --sweep's CSV"<<endl;
+        cerr << "  --replacement POLICIES  Replacement policy of each level, L1 first,"<<endl;
+        cerr << "                 comma separated (default: lru): lru, plru (tree pseudo-LRU,"<<endl;
+        cerr << "                 power of two associativity), fifo, random, srrip, brrip,"<<endl;
+        cerr << "                 or, for L1 with --replay or --sweep, opt (Belady's optimal)"<<endl;
+        cerr << "  --write POLICIES  Write policy of each level, L1 first, comma separated"<<endl;
+        cerr << "                 (default: wt): wt (write-through), wb (write-back, dirty"<<endl;
+        cerr << "                 blocks written back when evicted), each write-allocate,"<<endl;
+        cerr << "                 or wt-noalloc, wb-noalloc; prints writebacks and memory"<<endl;
+        cerr << "                 traffic after the log, or adds them to --sweep's CSV"<<endl;
+        cerr << "  --inclusion POLICIES  Inclusion policy of each level, L1 first, comma"<<endl;
+        cerr << "                 separated (default: nine): nine (neither inclusive nor"<<endl;
+        cerr << "                 exclusive), inclusive (of the levels above; evicting a"<<endl;
+        cerr << "                 block invalidates it above), exclusive (of the level"<<endl;
+        cerr << "                 above, filled only by its victims); L1 is always nine;"<<endl;
+        cerr << "                 prints the traffic like --write"<<endl;
+        cerr << "  --prefetch PREFETCHERS  Prefetcher of each level, L1 first, comma"<<endl;
+        cerr << "                 separated, each NAME[:DEGREE[:DISTANCE]] (default: none):"<<endl;
+        cerr << "                 nextline (tagged next-line), stride (by the pc of each"<<endl;
+        cerr << "                 lw), stream (stream buffers of DEGREE blocks), e.g."<<endl;
+        cerr << "                 stride:2:4; DEGREE blocks are prefetched at a time,"<<endl;
+        cerr << "                 DISTANCE blocks (or strides) ahead, both 1 by default."<<endl;
+        cerr << "                 After the log, prints each prefetcher's accuracy, coverage,"<<endl;
+        cerr << "                 lead and pollution, or adds them to --sweep's CSV"<<endl;
+        cerr << "  --latency LATENCIES  Turns on the timing model: hit latency in cycles of"<<endl;
+        cerr << "                 each level (L1I's is L1's), L1 first, then memory's latency,"<<endl;
+        cerr << "                 comma separated. Every lw, sw and fetch takes L1's latency,"<<endl;
+        cerr << "                 and each read reaching a level below, or memory, that"<<endl;
+        cerr << "                 level's too; writes below L1 don't stall. After the log,"<<endl;
+        cerr << "                 prints the cycles, CPI and average memory access time of"<<endl;
+        cerr << "                 each level, or adds them to --sweep's CSV"<<endl;
+        cerr << "  --base-cycles CYCLES  Cycles of each kind of instruction besides its"<<endl;
+        cerr << "                 memory accesses, comma separated KIND=N, KIND an"<<endl;
+        cerr << "                 instruction name (add, lw, jeq, ...) or default for the rest"<<endl;
+        cerr << "                 (default: default=1); --replay only tells lw and sw apart"<<endl;
+        cerr << "  --seed N       Seed for the random and brrip policies (default: 1)"<<endl;
+        cerr << "  --replay TRACE  Run the lw and sw in TRACE, recorded by sim --trace,"<<endl;
+        cerr << "                 through each --cache in turn instead of simulating a"<<endl;
+        cerr << "                 program; prints the same log as simulating it"<<endl;
+        cerr << "  --stack-distance  Instead of simulating one cache, print the lw hit rate"<<endl;
+        cerr << "                 of every LRU cache, by blocksize, associativity and"<<endl;
+        cerr << "                 size, worked out in a single run"<<endl;
+        cerr << "  --sweep SPEC   Instead of logging one cache, run every configuration in"<<endl;
+        cerr << "                 SPEC in parallel and print hits, misses and hit rate of"<<endl;
+        cerr << "                 each level as CSV. SPEC is SIZES:ASSOCS:BLOCKSIZES, with"<<endl;
+        cerr << "                 /SIZES:ASSOCS:BLOCKSIZES appended for each lower level,"<<endl;
+        cerr << "                 up to four; each is a"<<endl;
+        cerr << "                 list of numbers and ranges A-B (the powers of two from"<<endl;
+        cerr << "                 A to B), e.g. 64-1024:1-16:1,4,16"<<endl;
+        cerr << "  --threads N    Threads for --sweep (default: one per hardware thread)"<<endl;
+        cerr << "  --checkpoint FILE  Save a checkpoint, caches included, to FILE.n"<<endl;
+        cerr << "                 (n = instructions executed) on SIGUSR1, and every N"<<endl;
+        cerr << "                 instructions with --checkpoint-every N"<<endl;
+        cerr << "  --restore FILE  Resume from a checkpoint instead of loading filename; a"<<endl;
+        cerr << "                 checkpoint saved by sim starts with cold caches"<<endl;
+        cerr << "  --summary      After the log, print each level's accesses, hits, misses"<<endl;
+        cerr << "                 and hit rate, for loads and stores apart, its misses as"<<endl;
+        cerr << "                 compulsory, capacity (missing in a fully associative LRU"<<endl;
+        cerr << "                 cache of the same size too) and conflict misses, and the"<<endl;
+        cerr << "                 misses of each pc"<<endl;
+        cerr << "  --quiet        Leave out the log of each access"<<endl;
+        cerr << "  --stats        After the log, print how often each instruction, and each"<<endl;
+        cerr << "                 address, was executed, and how often jeq was taken"<<endl;
+        cerr << "  --trace-text FILE  Write every instruction executed to FILE, with the"<<endl;
+        cerr << "                 address of every lw and sw and the outcome of every jeq"<<endl;
         return 1;
     }
     
-    // *****************
-    // open file here
-    ifstream f(filename);
-    if (!f.is_open()) {
-        cerr << "Can't open file "<<filename<<endl;
-        return 1;
+    /* parse cache config */
+    vector<vector<LevelConfig>> hierarchies;
+    LevelConfig icache;
+    bool has_icache = false;
+    if (hierarchy != nullptr) {
+        hierarchies.emplace_back();
+        string error;
+        if (!parse_hierarchy(hierarchy, hierarchies.back(), icache, has_icache, error)) {
+            cerr << error << endl;
+            return 1;
+        }
     }
-    // *****************
-    
+    if (icache_config != nullptr) {
+        vector<LevelConfig> levels;
+        if (!parse_cache_config(icache_config, levels) || levels.size() != 1) {
+            cerr << "Invalid cache config"  << endl;
+            return 1;
+        }
+        icache = levels[0];
+        has_icache = true;
+    }
+    const LevelConfig *fetch_config = has_icache ? &icache : nullptr;
+    for (const string &cache_config : cache_configs) {
+        hierarchies.emplace_back();
+        if (!parse_cache_config(cache_config, hierarchies.back())) {
+            cerr << "Invalid cache config"  << endl;
+            return 1;
+        }
+        set_policies(hierarchies.back(), replacement, write, inclusion, prefetch);
+    }
+    for (const vector<LevelConfig> &levels : hierarchies) {
+        string error;
+        if (!check_hierarchy(levels, error, fetch_config)) {
+            cerr << error << endl;
+            return 1;
+        }
+        // OPT looks ahead in the recorded accesses, which only a replay has
+        if (levels[0].replacement == REPL_OPT && replay_name == nullptr) {
+            cerr << "Invalid cache config for L1: opt needs --replay or --sweep" << endl;
+            return 1;
+        }
+        if (!latency.empty() && latency.size() != levels.size() + 1) {
+            cerr << "Invalid latency: one for each level of cache, then one for memory" << endl;
+            return 1;
+        }
+    }
+
     // *****************
     // initialize processor state
         // pc, regs, and mem are initialized to 0
         // have max 16 bits (uint16_t)
-    uint16_t pc = 0;
-    uint16_t regs[8] = {0};
-    uint16_t mem[8192] = {0};
-    load_machine_code(f, mem);
+    Machine m;
+    init_machine(m);
+    uint64_t executed = 0;
+    vector<uint8_t> saved;
+    if (replay_name != nullptr) {
+        // nothing to load
+    }
+    else if (restore != nullptr) {
+        string error;
+        if (!restore_checkpoint(restore, m, executed, saved, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
+    else {
+        // open file here
+        string error;
+        if (!load_program(filename, m, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
     // *****************
         
-    /* parse cache config */
-    if (cache_config.size() > 0) {
-        vector<int> parts;
-        size_t pos;
-        size_t lastpos = 0;
-        while ((pos = cache_config.find(",", lastpos)) != string::npos) {
-            parts.push_back(stoi(cache_config.substr(lastpos,pos)));
-            lastpos = pos + 1;
-        }
-        parts.push_back(stoi(cache_config.substr(lastpos)));
-        if (parts.size() == 3) {
-            int L1size = parts[0];
-            int L1assoc = parts[1];
-            int L1blocksize = parts[2];
-            // TODO: execute E20 program and simulate one cache here
-            int blocksize[1] = {L1blocksize};
-            int rows = (L1size / L1assoc) / L1blocksize;
-            int num_rows[1] = {rows};
-            int assoc[1] = {L1assoc};
-            int num_of_cache = 1;
-            vector<vector<int>> L1 = create_cache(rows);
-            vector<vector<int>> L2 = {{0}};
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, rows);
-            bool halt = false;
-            while (halt == false) {
-                vector<uint16_t> return_vals = execute(mem, pc, regs, blocksize, num_rows, assoc, num_of_cache, L1, L2);
-                pc = return_vals[0];
-                if (return_vals[1] == 1) {
-                    halt = true;
-                }
+    // the timing model needs the number of each kind of instruction, which the statistics count
+    unique_ptr<ExecStats> stats;
+    if (do_stats || (!latency.empty() && replay_name == nullptr))
+        stats.reset(new ExecStats());
+    uint64_t instructions = 0;
+    ofstream trace_file;
+    unique_ptr<TextTrace> trace;
+    if (trace_text != nullptr) {
+        trace_file.open(trace_text);
+        if (!trace_file.is_open()) {
+            cerr << "Can't open file "<<trace_text<<endl;
+            return 1;
+        }
+        trace.reset(new TextTrace(trace_file));
+    }
+
+    // a replay through caches reads the trace once, for every configuration; an instruction
+    // cache needs the fetches too
+    AccessRecorder data_recorder;
+    FetchRecorder fetch_recorder;
+    AccessRecorder &recorder = has_icache ? fetch_recorder : data_recorder;
+    if (replay_name != nullptr && !do_stack_distance) {
+        string error;
+        if (has_icache ? !read_accesses(replay_name, fetch_recorder, error) :
+                !read_accesses(replay_name, data_recorder, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    }
+
+    if (do_stack_distance) {
+        unique_ptr<StackDistanceObserver> sd(new StackDistanceObserver());
+        if (replay_name != nullptr) {
+            TraceReader reader;
+            string error;
+            if (!reader.open(replay_name, error)) {
+                cerr << error << endl;
+                return 1;
             }
-        } else if (parts.size() == 6) {
-            int L1size = parts[0];
-            int L1assoc = parts[1];
-            int L1blocksize = parts[2];
-            int L2size = parts[3];
-            int L2assoc = parts[4];
-            int L2blocksize = parts[5];
-            // TODO: execute E20 program and simulate two caches here
-            int blocksize[2] = {L1blocksize, L2blocksize};
-            int L1_rows = (L1size / L1assoc) / L1blocksize;
-            int L2_rows = (L2size / L2assoc) / L2blocksize;
-            int num_rows[2] = {L1_rows, L2_rows};
-            int assoc[2] = {L1assoc, L2assoc};
-            int num_of_cache = 2;
-            vector<vector<int>> L1 = create_cache(L1_rows);
-            vector<vector<int>> L2 = create_cache(L2_rows);
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, L1_rows);
-            print_cache_config("L2", L2size, L2assoc, L2blocksize, L2_rows);
-            bool halt = false;
-            while (halt == false) {
-                vector<uint16_t> return_vals = execute(mem, pc, regs, blocksize, num_rows, assoc, num_of_cache, L1, L2);
-                pc = return_vals[0];
-                if (return_vals[1] == 1) {
-                    halt = true;
-                }
+            if (!replay_trace(reader, *sd)) {
+                cerr << reader.error << endl;
+                return 1;
             }
-            
-        } else {
-            cerr << "Invalid cache config"  << endl;
+        }
+        else {
+            with_policies(*sd, trace.get(), nullptr, stats.get(), [&](auto &obs) {
+                run(m, RUN_UNTIL_HALT, obs);
+            });
+        }
+        print_stack_distances(*sd);
+        if (do_stats)
+            print_stats(cout, *stats);
+    }
+
+    if (sweep != nullptr) {
+        vector<SweepPoint> points;
+        if (!parse_sweep(sweep, points)) {
+            cerr << "Invalid sweep " << sweep << endl;
             return 1;
         }
+        for (SweepPoint &point : points) {
+            vector<LevelConfig> levels(point.config, point.config + point.levels);
+            set_policies(levels, replacement, write, inclusion, prefetch);
+            string error;
+            if (!check_hierarchy(levels, error, fetch_config)) {
+                cerr << "Invalid sweep " << sweep << ": " << error << endl;
+                return 1;
+            }
+            if (!latency.empty() && latency.size() != levels.size() + 1) {
+                cerr << "Invalid latency: one for each level of cache, then one for memory" << endl;
+                return 1;
+            }
+            copy(levels.begin(), levels.end(), point.config);
+        }
+        // every configuration sees the same accesses, so the program only runs once
+        auto record = [&](auto &recording) {
+            with_policies(recording, trace.get(), nullptr, stats.get(), [&](auto &obs) {
+                run(m, RUN_UNTIL_HALT, obs);
+            });
+        };
+        if (replay_name == nullptr && has_icache)
+            record(fetch_recorder);
+        else if (replay_name == nullptr)
+            record(data_recorder);
+        run_pool(points.size(), pool_threads(threads), [&](size_t job, size_t) {
+            sweep_point(recorder, points[job], fetch_config, seed);
+        });
+        uint64_t base = 0;
+        if (!latency.empty())
+            base = stats ? executed_base_cycles(*stats, base_cycles, instructions) :
+                replayed_base_cycles(recorder, base_cycles, instructions);
+        bool prefetching = any_of(prefetch.begin(), prefetch.end(), [](const PrefetchConfig &p) {
+            return p.kind != PREFETCH_NONE;
+        });
+        print_sweep(points, write_given || inclusion_given, has_icache, prefetching, latency, base, instructions);
+        if (do_stats)
+            print_stats(cout, *stats);
+    }
+
+    /* run each cache config */
+    bool traffic = write_given || inclusion_given || hierarchy != nullptr;
+    for (const vector<LevelConfig> &levels : hierarchies) {
+        Cache caches[MAX_LEVELS];
+        Cache fetch_cache;
+        bool prefetching = false;
+        for (size_t level = 0; level < levels.size(); level++) {
+            const LevelConfig &config = levels[level];
+            caches[level] = create_cache(config, seed + level);
+            string prefetcher = string(PREFETCHER_NAMES[config.prefetch.kind]) + ", degree " +
+                to_string(config.prefetch.degree) + ", distance " + to_string(config.prefetch.distance);
+            prefetching |= config.prefetch.kind != PREFETCH_NONE;
+            print_cache_config(CACHE_NAMES[level], config.size, config.assoc, config.blocksize,
+                caches[level].num_rows,
+                config.replacement == REPL_LRU ? nullptr : REPLACEMENT_NAMES[config.replacement],
+                config.write == WRITE_THROUGH ? nullptr : WRITE_POLICY_NAMES[config.write],
+                config.inclusion == NINE ? nullptr : INCLUSION_NAMES[config.inclusion],
+                config.prefetch.kind == PREFETCH_NONE ? nullptr : prefetcher.c_str());
+            if (level == 0 && has_icache) {
+                fetch_cache = create_cache(icache, seed + MAX_LEVELS);
+                print_cache_config("L1I", icache.size, icache.assoc, icache.blocksize, fetch_cache.num_rows,
+                    icache.replacement == REPL_LRU ? nullptr : REPLACEMENT_NAMES[icache.replacement]);
+            }
+        }
+        int status = 0;
+        unique_ptr<CacheSummary> summary;
+        if (do_summary)
+            summary.reset(new CacheSummary(levels));
+        with_levels(levels.size(), caches, has_icache ? &fetch_cache : nullptr, !quiet, [&](auto &observer) {
+            observer.summary = summary.get();
+            if (replay_name != nullptr)
+                replay(recorder, observer);
+            else
+                status = simulate(m, observer, executed, saved, checkpoint, checkpoint_every, trace.get(), stats.get());
+            if (status == 0 && do_stats)
+                print_stats(cout, *stats);
+            if (status == 0 && has_icache)
+                print_fetches(observer);
+            if (status == 0 && traffic)
+                print_traffic(observer);
+            if (status == 0 && prefetching)
+                print_prefetches(observer);
+            if (status == 0 && do_summary)
+                print_summary(observer);
+            if (status == 0 && !latency.empty()) {
+                uint64_t base = stats ? executed_base_cycles(*stats, base_cycles, instructions) :
+                    replayed_base_cycles(recorder, base_cycles, instructions);
+                print_timing(observer, latency, base, instructions);
+            }
+        });
+        if (status != 0)
+            return status;
     }
     
     return 0;
@@ -0,0 +1,91 @@
+# bubble sort of 60 words, reached through a pointer so they can sit past the reach of an
+# immediate; each pass stops one word earlier, and the sort ends on a pass without a swap
+    j start
+base:
+    .fill arr
+start:
+    movi $6, 60
+outer:
+    lw $1, base($0)
+    movi $5, 0
+    add $4, $1, $6
+    addi $4, $4, -1
+inner:
+    jeq $1, $4, endinner
+    lw $2, 0($1)
+    lw $3, 1($1)
+    slt $7, $3, $2
+    jeq $7, $0, noswap
+    sw $3, 0($1)
+    sw $2, 1($1)
+    movi $5, 1
+noswap:
+    addi $1, $1, 1
+    j inner
+endinner:
+    addi $6, $6, -1
+    jeq $5, $0, done
+    j outer
+done:
+    halt
+arr:
+    .fill 56342
+    .fill 1063
+    .fill 25884
+    .fill 43670
+    .fill 7964
+    .fill 44386
+    .fill 7631
+    .fill 23213
+    .fill 55927
+    .fill 58675
+    .fill 44228
+    .fill 7087
+    .fill 7858
+    .fill 24374
+    .fill 4969
+    .fill 28825
+    .fill 31003
+    .fill 27846
+    .fill 65000
+    .fill 4135
+    .fill 65468
+    .fill 6400
+    .fill 44846
+    .fill 24788
+    .fill 7522
+    .fill 1216
+    .fill 44262
+    .fill 46302
+    .fill 7576
+    .fill 674
+    .fill 11134
+    .fill 17983
+    .fill 30891
+    .fill 29441
+    .fill 14880
+    .fill 62131
+    .fill 57255
+    .fill 24570
+    .fill 44729
+    .fill 47032
+    .fill 2136
+    .fill 22889
+    .fill 53749
+    .fill 61064
+    .fill 14666
+    .fill 4330
+    .fill 52031
+    .fill 18464
+    .fill 38344
+    .fill 46552
+    .fill 52420
+    .fill 35132
+    .fill 10719
+    .fill 4432
+    .fill 65392
+    .fill 1623
+    .fill 46683
+    .fill 25134
+    .fill 12015
+    .fill 57262
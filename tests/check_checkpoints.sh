@@ -0,0 +1,49 @@
+#!/bin/sh
+# usage: tests/check_checkpoints.sh ASM SIM SIMCACHE
+# assembles each tests/*.s with ASM, runs it with a checkpoint every 300000 instructions, and
+# checks that a run restored from each checkpoint continues exactly: SIM must print the same
+# final state, and SIMCACHE the same lw and sw log as the end of the uninterrupted run, dirty
+# lines and writebacks included; the caches use lru and fifo, whose order a checkpoint keeps
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+every=300000
+status=0
+restored=0
+for source in "$dir"/*.s; do
+    name=$(basename "$source" .s)
+    "$1" "$source" > "$tmp/$name.bin" || { echo "FAIL $name: can't assemble"; status=1; continue; }
+    "$2" --checkpoint "$tmp/sim" --checkpoint-every $every "$tmp/$name.bin" > "$tmp/$name.sim"
+    for checkpoint in "$tmp"/sim.*; do
+        [ -e "$checkpoint" ] || continue
+        restored=$((restored + 1))
+        "$2" --restore "$checkpoint" > "$tmp/restored.sim"
+        if ! cmp -s "$tmp/$name.sim" "$tmp/restored.sim"; then
+            echo "FAIL $name: sim --restore $(basename "$checkpoint") ends in a different state"
+            status=1
+        fi
+    done
+    rm -f "$tmp"/sim.*
+    for caches in "--cache 16,2,2,64,4,4 --write wb,wb --icache 16,2,4" \
+            "--cache 32,4,4,128,8,8 --write wb,wt --replacement lru,fifo --inclusion nine,inclusive" \
+            "--cache 16,2,2,64,4,2 --write wb,wb-noalloc --inclusion nine,exclusive"; do
+        "$3" $caches --checkpoint "$tmp/simcache" --checkpoint-every $every "$tmp/$name.bin" |
+            grep "pc:" > "$tmp/$name.log"
+        for checkpoint in "$tmp"/simcache.*; do
+            [ -e "$checkpoint" ] || continue
+            restored=$((restored + 1))
+            "$3" $caches --restore "$checkpoint" | grep "pc:" > "$tmp/restored.log"
+            if ! tail -n "$(wc -l < "$tmp/restored.log")" "$tmp/$name.log" | cmp -s - "$tmp/restored.log"; then
+                echo "FAIL $name: simcache $caches --restore $(basename "$checkpoint") logs differently"
+                status=1
+            fi
+        done
+        rm -f "$tmp"/simcache.*
+    done
+done
+if [ $restored = 0 ]; then
+    echo "FAIL: no program ran long enough to checkpoint"
+    status=1
+fi
+[ $status = 0 ] && echo "All $restored restored runs continue exactly"
+exit $status
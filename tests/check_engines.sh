@@ -0,0 +1,24 @@
+#!/bin/sh
+# usage: tests/check_engines.sh ASM SIM
+# assembles each tests/*.s with ASM and checks that every engine of SIM ends in the same
+# state as the switch core; the JIT is skipped where it isn't available
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+status=0
+for source in "$dir"/*.s; do
+    name=$(basename "$source" .s)
+    "$1" "$source" > "$tmp/$name.bin" || { echo "FAIL $name: can't assemble"; status=1; continue; }
+    "$2" --engine switch "$tmp/$name.bin" > "$tmp/$name.switch"
+    for engine in threaded block jit; do
+        if ! "$2" --engine $engine "$tmp/$name.bin" > "$tmp/$name.$engine" 2> "$tmp/$name.err"; then
+            grep -q "The JIT needs" "$tmp/$name.err" && continue
+        fi
+        if ! cmp -s "$tmp/$name.switch" "$tmp/$name.$engine"; then
+            echo "FAIL $name: --engine $engine differs from switch"
+            status=1
+        fi
+    done
+done
+[ $status = 0 ] && echo "All engines agree"
+exit $status
@@ -0,0 +1,72 @@
+#!/bin/sh
+# usage: tests/check_simcache_modes.sh ASM SIM SIMCACHE
+# assembles each tests/*.s with ASM and checks that SIMCACHE's modes agree on it:
+#   --replay of SIM's --trace logs exactly what --cache logs running the program
+#   --sweep gives each level the load hits and misses that --summary does
+#   --stack-distance gives each LRU cache the load hits that --cache does
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+status=0
+
+# load_counts LEVEL: "hits misses" of LEVEL's loads, from --summary output on stdin
+load_counts() {
+    sed -n "s/^$1 loads [0-9]*, hits \([0-9]*\), misses \([0-9]*\),.*/\1 \2/p"
+}
+
+# sweep_counts LEVEL: "hits misses" of LEVEL, from --sweep CSV on stdin
+sweep_counts() {
+    awk -F, -v h="$1 hits" -v m="$1 misses" '
+        NR == 1 { for (i = 1; i <= NF; i++) { if ($i == h) hc = i; if ($i == m) mc = i } }
+        NR == 2 && hc && mc { print $hc, $mc }'
+}
+
+for source in "$dir"/*.s; do
+    name=$(basename "$source" .s)
+    "$1" "$source" > "$tmp/$name.bin" || { echo "FAIL $name: can't assemble"; status=1; continue; }
+    "$2" --trace "$tmp/$name.e20t" "$tmp/$name.bin" > /dev/null
+    # cache|policy options; every level of each runs lru, so --stack-distance applies to L1
+    for config in "16,2,2,64,4,4|--write wb,wb --prefetch nextline,stride --icache 16,2,4" \
+            "8,2,2,32,4,4,128,8,8|--write wb,wt,wb --inclusion nine,inclusive,nine --prefetch stream:2" \
+            "32,4,4|--write wt-noalloc --icache 8,1,2" \
+            "64,16,4|"; do
+        caches=${config%%|*}
+        options=${config#*|}
+        "$3" --cache $caches $options "$tmp/$name.bin" > "$tmp/run.log"
+        "$3" --replay "$tmp/$name.e20t" --cache $caches $options > "$tmp/replay.log"
+        if ! cmp -s "$tmp/run.log" "$tmp/replay.log"; then
+            echo "FAIL $name: --replay --cache $caches $options logs differently from running it"
+            status=1
+        fi
+        "$3" --cache $caches $options --summary --quiet "$tmp/$name.bin" > "$tmp/summary"
+        spec=$(echo "$caches" | awk -F, '{ for (i = 1; i <= NF; i += 3) { printf "%s%s:%s:%s", separator, $i, $(i + 1), $(i + 2); separator = "/" } }')
+        "$3" --sweep "$spec" --threads 1 $options "$tmp/$name.bin" > "$tmp/sweep.csv"
+        level=1
+        for size in $(echo "$caches" | awk -F, '{ for (i = 1; i <= NF; i += 3) print $i }'); do
+            summary=$(load_counts L$level < "$tmp/summary")
+            sweep=$(sweep_counts L$level < "$tmp/sweep.csv")
+            if [ -z "$summary" ] || [ "$summary" != "$sweep" ]; then
+                echo "FAIL $name: --sweep $spec gives L$level $sweep load hits and misses, --summary $summary"
+                status=1
+            fi
+            level=$((level + 1))
+        done
+    done
+    "$3" --stack-distance "$tmp/$name.bin" > "$tmp/distances"
+    for caches in 16,1,1 16,2,2 32,4,4 64,2,8 64,16,4 128,8,2; do
+        hits=$("$3" --cache $caches --summary --quiet "$tmp/$name.bin" | load_counts L1 | cut -d' ' -f1)
+        distance=$(echo "$caches" | awk -F, '{ print $1, $2, $3 }' | {
+            read size assoc blocksize
+            [ $((assoc * blocksize)) = $size ] && assoc=full
+            awk -v section="Blocksize $blocksize, associativity $assoc" -v size=$size '
+                /^Blocksize/ { inside = $0 == section }
+                inside && $1 == size { print $3; exit }' "$tmp/distances"
+        })
+        if [ -z "$hits" ] || [ "$hits" != "$distance" ]; then
+            echo "FAIL $name: --stack-distance gives --cache $caches $distance load hits, --cache $hits"
+            status=1
+        fi
+    done
+done
+[ $status = 0 ] && echo "All simcache modes agree"
+exit $status
@@ -0,0 +1,10 @@
+#!/bin/sh
+# usage: tests/check_trace.sh ASM
+# builds trace_roundtrip.cpp with $CXX (g++ by default), assembles tests/long_loop.s with ASM,
+# and checks that its .e20t trace, which spans several blocks, replays exactly as it ran
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+${CXX:-g++} -O2 -pthread -o "$tmp/trace_roundtrip" "$dir/trace_roundtrip.cpp" || { echo "FAIL: can't build trace_roundtrip"; exit 1; }
+"$1" "$dir/long_loop.s" > "$tmp/long_loop.bin" || { echo "FAIL long_loop: can't assemble"; exit 1; }
+"$tmp/trace_roundtrip" "$tmp/long_loop.bin" "$tmp/long_loop.e20t"
@@ -0,0 +1,100 @@
+# a lw/sw loop long enough that its .e20t trace spans several 64K blocks, with runs of over
+# 63 instructions, jumps and address deltas too far for a tag byte, and values of every varint
+# length; stores go to 4096..5119 and 7000, so write-back caches end up with dirty lines
+    j start
+count:
+    .fill 30000
+mask:
+    .fill 1023
+base:
+    .fill 4096
+far:
+    .fill 7000
+start:
+    lw $1, count($0)
+    lw $6, mask($0)
+loop:
+    addi $5, $5, 61
+    and $3, $2, $6
+    lw $4, base($0)
+    add $3, $3, $4
+    sw $5, 0($3)
+    lw $4, far($0)
+    lw $3, 0($4)
+    add $3, $3, $5
+    sw $3, 0($4)
+    jal sub
+    addi $2, $2, 1
+    addi $1, $1, -1
+    jeq $1, $0, done
+    j loop
+done:
+    halt
+sub:
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    nop
+    jr $7
@@ -0,0 +1,19 @@
+# a sw run at pc 8192 + high, where the block engine steps instead of running blocks,
+# rewrites sub, which the first call translated; every engine must end with $2 = 11
+    jal sub
+    lw $3, far($0)
+    jr $3
+high:
+    lw $4, patch($0)
+    sw $4, sub($0)
+    jal sub
+    j done
+done:
+    halt
+sub:
+    addi $2, $0, 2
+    jr $7
+patch:
+    addi $2, $0, 11
+far:
+    .fill 8195
@@ -0,0 +1,141 @@
+/*
+E20 trace round trip test
+trace_roundtrip.cpp
+
+usage: trace_roundtrip PROGRAM TRACE
+runs PROGRAM (machine code, as sim reads it) while recording TRACE with
+BinaryTrace and keeping every instruction, lw and sw in memory too, then
+replays TRACE with replay_trace and checks it gives back the same pcs,
+addresses and values in the same order. The trace must span more than
+one block, so that the block boundaries are checked as well.
+Prints "Trace round trip OK", or what differs, and exits 1 if anything does.
+*/
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../e20.h"
+#include "../e20_engine.h"
+#include "../e20_image.h"
+#include "../e20_trace.h"
+
+using namespace std;
+
+/*
+    Recorder
+    observer keeping every instruction, lw and sw as the TraceRecord it should read back as
+        records = everything seen, in order
+ */
+struct Recorder : NoObserver {
+    static const bool sees_every_instruction = true;
+    vector<TraceRecord> records;
+
+    void on_instr(uint16_t pc, uint16_t) {
+        records.push_back({TRACE_INSTR, pc, 0, 0});
+    }
+
+    void on_lw(uint16_t pc, int addr, uint16_t value) {
+        records.push_back({TRACE_LW, pc, (uint16_t)addr, value});
+    }
+
+    void on_sw(uint16_t pc, int addr, uint16_t value) {
+        records.push_back({TRACE_SW, pc, (uint16_t)addr, value});
+    }
+};
+
+/*
+    count_blocks(name, blocks, instrs)
+    walks the block headers of the trace file name
+    returns false if a block header runs past the end of the file
+    parameters:
+        name = trace file
+        blocks = set to the number of blocks
+        instrs = set to the instructions the blocks say they hold
+ */
+bool count_blocks(const string &name, uint64_t &blocks, uint64_t &instrs) {
+    ifstream in(name, ios::binary);
+    in.seekg(TRACE_HEADER_SIZE);
+    blocks = 0;
+    instrs = 0;
+    uint8_t header[TRACE_BLOCK_HEADER_SIZE];
+    while (in.read((char *)header, sizeof(header))) {
+        blocks++;
+        instrs += trace_get32(header + 4);
+        in.seekg(trace_get32(header), ios::cur);
+    }
+    return in.gcount() == 0 && in.eof();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        cerr << "usage " << argv[0] << " PROGRAM TRACE" << endl;
+        return 1;
+    }
+    Machine m;
+    init_machine(m);
+    string error;
+    if (!load_program(argv[1], m, error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    Recorder live;
+    BinaryTrace record;
+    if (!record.open(argv[2], error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    NoObserver off;
+    Policies<Recorder, NoObserver, BinaryTrace, NoObserver> obs = {live, off, record, off};
+    run(m, RUN_UNTIL_HALT, obs);
+    if (!record.finish(error)) {
+        cerr << error << endl;
+        return 1;
+    }
+
+    uint64_t blocks, instrs;
+    if (!count_blocks(argv[2], blocks, instrs)) {
+        cout << "FAIL: the last block is truncated" << endl;
+        return 1;
+    }
+    uint64_t live_instrs = 0;
+    for (const TraceRecord &r : live.records)
+        if (r.kind == TRACE_INSTR)
+            live_instrs++;
+    if (blocks < 2) {
+        cout << "FAIL: the trace is a single block, so no boundary is crossed" << endl;
+        return 1;
+    }
+    if (instrs != live_instrs) {
+        cout << "FAIL: the block headers hold " << instrs << " instructions, not " << live_instrs << endl;
+        return 1;
+    }
+
+    TraceReader reader;
+    if (!reader.open(argv[2], error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    Recorder replayed;
+    if (!replay_trace(reader, replayed)) {
+        cout << "FAIL: " << reader.error << endl;
+        return 1;
+    }
+    for (size_t i = 0; i < live.records.size() && i < replayed.records.size(); i++) {
+        const TraceRecord &a = live.records[i];
+        const TraceRecord &b = replayed.records[i];
+        if (a.kind != b.kind || a.pc != b.pc || a.addr != b.addr || a.value != b.value) {
+            cout << "FAIL: record " << i << " was kind " << (int)a.kind << " pc " << a.pc << " addr " << a.addr <<
+                " value " << a.value << ", read back as kind " << (int)b.kind << " pc " << b.pc << " addr " <<
+                b.addr << " value " << b.value << endl;
+            return 1;
+        }
+    }
+    if (live.records.size() != replayed.records.size()) {
+        cout << "FAIL: " << live.records.size() << " records, " << replayed.records.size() << " read back" << endl;
+        return 1;
+    }
+    cout << "Trace round trip OK: " << live.records.size() << " records in " << blocks << " blocks" << endl;
+    return 0;
+}